@@ -279,33 +279,54 @@ void printRoomDetails(char matrix[][COLS], struct Rectangle *rooms, int roomInde
 }
 
 
-void dfs(int room, int numRooms, int connections[][numRooms], int visited[]) {
-    visited[room] = 1;
+// Union-find (disjoint set) over room indices: rooms in the same set are already
+// connected to each other through corridors, and components counts the sets
+struct UnionFind {
+    int *parent;
+    int *size;
+    int components;
+};
 
+void initUnionFind(struct UnionFind *uf, int numRooms) {
+    uf->parent = malloc(numRooms * sizeof(int));
+    uf->size = malloc(numRooms * sizeof(int));
+    uf->components = numRooms;
     for (int i = 0; i < numRooms; i++) {
-        if (connections[room][i] && !visited[i]) {
-            dfs(i, numRooms, connections, visited);
-        }
+        uf->parent[i] = i;
+        uf->size[i] = 1;
     }
 }
 
-int isFullyTransitive(int numRooms, int connections[][numRooms]) {
-    int visited[numRooms];
-    for (int i = 0; i < numRooms; i++) {
-        visited[i] = 0;
-    }
-
-    // Start DFS from the first room
-    dfs(0, numRooms, connections, visited);
+void freeUnionFind(struct UnionFind *uf) {
+    free(uf->parent);
+    free(uf->size);
+}
 
-    // Check if all rooms were visited
-    for (int i = 0; i < numRooms; i++) {
-        if (!visited[i]) {
-            return 0; // Not fully transitive
-        }
+// returns the representative room of a room's set, compressing the path on the way
+int findSet(struct UnionFind *uf, int room) {
+    while (uf->parent[room] != room) {
+        uf->parent[room] = uf->parent[uf->parent[room]]; // path halving
+        room = uf->parent[room];
     }
+    return room;
+}
 
-    return 1; // Fully transitive
+// merges the sets of two rooms, returns 1 if they were not connected before
+int unionSets(struct UnionFind *uf, int room1, int room2) {
+    int root1 = findSet(uf, room1);
+    int root2 = findSet(uf, room2);
+    if (root1 == root2) {
+        return 0;
+    }
+    if (uf->size[root1] < uf->size[root2]) {
+        int swap = root1;
+        root1 = root2;
+        root2 = swap;
+    }
+    uf->parent[root2] = root1;
+    uf->size[root1] += uf->size[root2];
+    uf->components--;
+    return 1;
 }
 
 
@@ -418,11 +439,13 @@ struct Rectangle *placeCorridors(char matrix[][COLS], struct Rectangle *rooms, i
         }
     }
 
-    // debugging message
-    // printf("Initial matrix fully transitive: %d\n", isFullyTransitive(numRooms, connections));
+    // track which rooms are connected as corridors are added, so checking
+    // whether every room is reachable yet is a single comparison
+    struct UnionFind connected;
+    initUnionFind(&connected, numRooms);
 
     struct Rectangle *corridors = malloc(numCorridors * sizeof(struct Rectangle));
-    while (isFullyTransitive(numRooms, connections) == 0 && placed < numCorridors) {
+    while (connected.components > 1 && placed < numCorridors) {
         int isTall = rand() % 2; // 0 for wide, 1 for tall
         int width = isTall ? 3 : rand() % 10 + 7;
         int height = isTall ? rand() % 10 + 7 : 3;
@@ -474,6 +497,7 @@ struct Rectangle *placeCorridors(char matrix[][COLS], struct Rectangle *rooms, i
                     // Update the connections matrix
                     connections[intersectedRooms[0]][intersectedRooms[1]] = 1;
                     connections[intersectedRooms[1]][intersectedRooms[0]] = 1;
+                    unionSets(&connected, intersectedRooms[0], intersectedRooms[1]);
                 } else {
                     // printf("Error: corridor intersects 2 rooms but not all 4 corners are inside a room\n");
                 }
@@ -485,6 +509,7 @@ struct Rectangle *placeCorridors(char matrix[][COLS], struct Rectangle *rooms, i
             //// TODO: trigger a new map generation because the current room setup seems
             //         to make placing corridors difficult
             printf("Epoch limit reached, returning corridors\n");
+            freeUnionFind(&connected);
             return corridors;
         }
 
@@ -509,9 +534,12 @@ struct Rectangle *placeCorridors(char matrix[][COLS], struct Rectangle *rooms, i
                     connections[i][j] = 0;
                 }
             }
+            freeUnionFind(&connected);
+            initUnionFind(&connected, numRooms);
         }
     }
     printf("corridors completed on epoch: %d\n", epoch);
+    freeUnionFind(&connected);
     return corridors;
 }
 
@@ -1,7 +1,34 @@
+#ifdef SERVER
+#define _GNU_SOURCE // for accept4
+#endif
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+#if defined(BENCHMARK) || defined(SERVER)
+#include <pthread.h>
+#endif
+#ifdef SERVER
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 /* DESCRIPTION OF STUDY
 
@@ -44,11 +71,12 @@ the code further.
 */
 
 /* Notes:
-- The player is represented by the character '@'
+- The player is represented by the character '@', drawn over the map when printing
 - The exit is represented by the character 'E'
 - The treasure is represented by the character 'T'
-- Currently, each room has an index from 0 to 8, and is represented internally by a number from 0 to 8
-- The game currently supports a maximum of 9 rooms per level
+- The map stores enum TileType values, tileGlyphs gives the character each is printed as
+- Levels are laid out on a grid of cells with at most one room per cell, so a level holds up to
+  gridCols * gridRows rooms, indexed from 0; the game itself plays the classic 3x3 grid (up to 9 rooms)
 */
 
 /* Ideas:
@@ -65,7 +93,8 @@ the code further.
 //        (i.e. all rooms have a connection of 2 except for the first and last rooms, see seed
 //         1715609156 and 1715609348 for an example of this... ideally neither treasure room
 //         nor the exit would be next to the starting room, though they could be next to each other)
-/// TODO: fix bug where doors are sometimes not correctly detected, see room seed 1715568364 or 1715568497 as examples
+// DONE: fix bug where doors are sometimes not correctly detected, see room seed 1715568364 or 1715568497 as examples
+//       (doors are now placed at the corridor ends placeCorridors records, instead of being detected)
 // DONE: fix bug where the exit is sometimes placed in the upper left room (see seed 24 or 30 for examples)
 // DONE: fix bug where the exit is sometimes placed not in the farthest room away from the player (seed seed 28 for example)
 // DONE: place exit at bottom right of farthest room from starting room
@@ -106,7 +135,6 @@ struct Rectangle
     int yPos;
     int width;
     int height;
-    char wallChar;
 };
 
 struct Point {
@@ -114,132 +142,491 @@ struct Point {
     int y; // row, starting at the top w/ row 0
 };
 
-int ROWS = 30;
-int COLS = 60;
-int MAX_ROOM_COUNT = 9;
-char PLAYER_CHAR = '@';
-char EXIT_CHAR = 'E';
-char TREASURE_CHAR = 'T';
+/**
+ * xoshiro128** random number generator state.
+ *
+ * Every generator owns one of these per generation stage, so the stages draw
+ * from independent streams and no thread ever touches libc's rand() lock.
+ */
+struct Rng {
+    uint32_t s[4];
+};
+
+// The independent random streams a level is generated from, one per stage
+enum RngStream {
+    STREAM_ROOMS,
+    STREAM_CORRIDORS,
+    STREAM_PLACEMENT,
+    STREAM_BOT // the headless build's random player
+};
+
+// The stages of generateLevel that can be timed separately, see Generator.stageNanos
+enum GenStage {
+    STAGE_PLACE_ROOMS,
+    STAGE_PLACE_CORRIDORS,
+    STAGE_PLACE_DOORS,
+    STAGE_FARTHEST_ROOM,
+    STAGE_PLACE_EXIT_TREASURE,
+    STAGE_COUNT
+};
+
+const char *stageNames[STAGE_COUNT] = {
+    "placeRooms", "placeCorridors", "placeDoors", "farthestRoom", "exit/treasure"
+};
+
+// One end of a corridor: the corridor tile just outside a room's wall, the room and which wall
+struct CorridorEnd {
+    struct Point point;
+    int room; // room index
+    int wall; // 0 North, 1 East, 2 South, 3 West
+};
+
+// The step one tile towards each wall, indexed like CorridorEnd.wall
+const int wallStepX[4] = {0, 1, 0, -1};
+const int wallStepY[4] = {-1, 0, 1, 0};
+
+// One straight stretch of a corridor: length steps towards a wall direction
+struct CorridorRun {
+    uint8_t direction; // 0 North, 1 East, 2 South, 3 West
+    uint8_t length; // a longer stretch is split into several runs
+};
+
+/**
+ * A corridor as a polyline: the tile its carving started on, then the runs
+ * stepped from there, which end on the tile it was carved to.
+ *
+ * The runs of every corridor in a level sit back to back in one pool, see
+ * Level.corridorRuns, and corridorTiles walks them tile by tile.
+ */
+struct Corridor {
+    struct Point start;
+    int firstRun; // index of its first run in the pool
+    int runCount;
+    int rooms[2]; // the room it starts from and the room it leads to
+};
+
+/**
+ * Generator context that owns all of the state used while building a level.
+ *
+ * Everything placeRooms/placeCorridors need lives here instead of in file-scope
+ * globals, so independent generations can run on separate threads at once as
+ * long as each thread uses its own Generator and Level.
+ *
+ * The map is a gridCols x gridRows grid of cells ("quadrants" on the classic 3x3
+ * grid) that hold at most one room each. Set one up with initGenerator.
+ */
+struct Generator {
+    int gridCols; // cells across the map
+    int gridRows; // cells down the map
+    int *cellScratch; // 4 * gridCols * gridRows ints of working space for placeRooms, placeCorridors and farthestRoom
+    unsigned char *openScratch; // which tiles are passable, padded with a blocked border, then a working copy, for buildDistanceField
+    int *tileQueue; // one int per tile, buildDistanceField's queue
+    unsigned char openPairs[256][2]; // whether each of the two tiles packed in a byte is passable
+    int layoutIndex; // index of the room layout in connectedLayouts, -1 on grids other than 3x3
+    int numRooms; // Number of rooms to generate
+    uint64_t randomSeed; // the seed this generation was started from
+    struct Rng roomsRng; // draws for placeRooms
+    struct Rng corridorsRng; // draws for placeCorridors
+    struct Rng placementRng; // draws for placing things inside rooms
+    struct Point firstWallPoint; // To track the start of a corridor when building it
+    struct Point secondWallPoint; // To track the end of a corridor when building it
+    long long *stageNanos; // when not NULL, generateLevel adds each stage's wall time here (STAGE_COUNT entries)
+};
+
+// What a map tile is. The map stores these packed two to a byte, their glyphs
+// live in tileGlyphs and are only looked at when printing
+enum TileType {
+    TILE_BLANK, // must be 0, unwritten chunks read as blank
+    TILE_WALL_HORIZONTAL,
+    TILE_WALL_VERTICAL,
+    TILE_FLOOR,
+    TILE_CORRIDOR,
+    TILE_DOOR,
+    TILE_EXIT,
+    TILE_TREASURE,
+    TILE_FOG, // see fillRectWithStars
+    TILE_TYPE_COUNT // at most 16, so a tile fits in 4 bits
+};
+
+const char tileGlyphs[TILE_TYPE_COUNT] = {' ', '-', '|', '.', '#', '%', 'E', 'T', '*'};
+
+// Flags in tileProperties
+#define TILE_PASSABLE 0x01 // the player can step onto it
+#define TILE_BLOCKS_SIGHT 0x02
+#define TILE_IS_DOOR 0x04
+#define TILE_IS_EXIT 0x08 // stepping onto it wins the level
+#define TILE_IS_TREASURE 0x10 // stepping onto it picks up the treasure
+
+const unsigned char tileProperties[TILE_TYPE_COUNT] = {
+    [TILE_BLANK] = TILE_BLOCKS_SIGHT,
+    [TILE_WALL_HORIZONTAL] = TILE_BLOCKS_SIGHT,
+    [TILE_WALL_VERTICAL] = TILE_BLOCKS_SIGHT,
+    [TILE_FLOOR] = TILE_PASSABLE,
+    [TILE_CORRIDOR] = TILE_PASSABLE,
+    [TILE_DOOR] = TILE_PASSABLE | TILE_IS_DOOR,
+    [TILE_EXIT] = TILE_PASSABLE | TILE_IS_EXIT,
+    [TILE_TREASURE] = TILE_PASSABLE | TILE_IS_TREASURE,
+    [TILE_FOG] = TILE_BLOCKS_SIGHT,
+};
+
+// Tiles are stored in square chunks of CHUNK_SIZE x CHUNK_SIZE, see struct TileMap
+#define CHUNK_SHIFT 6
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+
+/**
+ * The tile board, stored on the heap as fixed-size chunks.
+ *
+ * A chunk is only allocated the first time something other than TILE_BLANK is
+ * written into it, so a huge map only costs memory where rooms and corridors
+ * actually are. Each chunk packs two 4-bit enum TileType values per byte, the
+ * even column in the low nibble. Always go through getTile/setTile.
+ */
+struct TileMap {
+    int rows;
+    int cols;
+    int chunkCols; // chunks per row of chunks
+    int chunkRows;
+    unsigned char **chunks; // chunkRows * chunkCols chunks of CHUNK_SIZE * CHUNK_SIZE / 2 bytes, NULL until first written
+    int allocatedChunks;
+};
+
+/**
+ * Which rooms are joined by a corridor, in compressed sparse row form.
+ *
+ * The rooms next to room i are neighbors[offsets[i]] up to (not including)
+ * neighbors[offsets[i + 1]], so walking a room's corridors touches only real
+ * edges, and the whole graph takes 4 bytes per room plus 4 per corridor.
+ */
+struct RoomGraph {
+    int numRooms;
+    int *offsets; // numRooms + 1 entries
+    uint16_t *neighbors; // two entries per corridor, one from each end
+};
+
+/**
+ * Every room of a level, stored as parallel arrays so a scan over one field
+ * reads densely packed 16-bit values.
+ *
+ * Room i covers x[i], y[i], width[i] and height[i] tiles (walls included) and
+ * sits in grid cell quadrant[i]. roomOfQuadrant maps each cell back to the room
+ * in it, or -1, so going from a cell or a tile to its room takes no search.
+ */
+struct RoomTable {
+    int count;
+    int gridCols; // cells across the grid
+    int cells; // cells in the grid
+    uint16_t *x; // x, y, width, height and quadrant share one allocation
+    uint16_t *y;
+    uint16_t *width;
+    uint16_t *height;
+    uint16_t *quadrant;
+    int *roomOfQuadrant; // one entry per cell
+};
+
+// A level pack mapped into memory, see openLevelPack
+struct LevelPack {
+    unsigned char *base; // the whole file
+    size_t size;
+    uint32_t levelCount;
+    const struct PackIndexEntry *index; // levelCount entries sorted by seed
+};
+
+/**
+ * A fully generated level: the tile board plus everything the game loop needs.
+ */
+struct Level {
+    struct TileMap tiles; // the board
+    struct RoomTable rooms;
+    struct Corridor *corridors; // the hallways connecting the rooms, corridorCount of them
+    struct CorridorRun *corridorRuns; // the pool every corridor's runs are stored in
+    int corridorRunCount;
+    struct CorridorEnd *corridorEnds; // both ends of every corridor, 2 * corridorCount of them
+    struct Point *doors; // one door per corridor end, in the same order as corridorEnds
+    int corridorCount;
+    struct RoomGraph connections; // which rooms are joined by corridors
+    int *connectionsCount; // an array of ints where each index i is the number of connections room i has
+    int roomCount;
+    int startRoomIndex; // the top left room, where the player starts
+    int exitRoomIndex; // the farthest room from the starting room
+    int treasureRoomIndex;
+    struct Point playerLocation;
+    struct Point exitLocation;
+    struct Point treasureLocation;
+    uint16_t *exitDistances; // steps from each tile (row by row) to the exit, NULL until buildDistanceFields
+    uint16_t *treasureDistances; // steps from each tile to where the treasure was placed
+    const struct LevelPack *pack; // the pack its arrays point into, NULL if generateLevel allocated them
+};
+
+#define DISTANCE_UNREACHABLE UINT16_MAX // in a Level's distance fields, a tile with no way there
+
+const int CELL_ROWS = 10; // tiles per grid cell, so the classic 3x3 grid makes a 30x60 map
+const int CELL_COLS = 20;
+char PLAYER_CHAR = '@'; // drawn over the map by printMatrix, never stored in it
 // int fixedSeed = 0; // NULL means random, 0 is constant // fav seeds: 1715544555, 0, 19, 1715568562, 1715609077, 1715609839
-int randomSeed;
 int printNotQuit = 1; // when we quit, we don't reprint the board (1 means print the board, 0 means don't print the board)
-int quadrantsUsed[9] = {-1}; // To track used quadrants
-int wallsUsed[9][4] = {{0}}; // To track used walls between rooms
-int neighborsSimple[9] = {-1}; // To track the neighbors of a room
-int numRooms; // Number of rooms to generate
-// Directions for cardinally adjacent cells in a flat array representation
-int directionShifts[] = {-3, 3, -1, 1}; // Up, Down, Left, Right
-struct Point* firstWallPoint; // To track the start of a corridor when building it
-struct Point* secondWallPoint; // To track the end of a corridor when building it
-int epochs = 0; // To track the number of epochs it takes to generate a valid map
 
 /**
- * Clears the values of the neighbors array.
+ * Returns a monotonic wall clock reading in nanoseconds.
  *
- * @param neighbors An array of integers representing the neighbors of a room.
+ * Unlike clock(), this measures elapsed time rather than CPU time, and never
+ * jumps backwards, so differences between two readings are safe to time with.
+ *
+ * @return Nanoseconds since an arbitrary fixed point.
+ */
+long long monotonicNanos(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (long long)(counter.QuadPart * (1e9 / frequency.QuadPart));
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+#endif
+}
+
+/**
+ * Adds the time since stageStart to a stage's total, if the generator is being timed.
+ *
+ * @param gen The generator being timed.
+ * @param stage The stage that just finished.
+ * @param stageStart The monotonicNanos reading taken when the stage started.
+ * @return The current reading, to time the next stage from (0 when not timing).
  */
-void clearNeighborsSimple(int neighbors[]) {
-    for (int i = 0; i < 9; i++) {
-        neighbors[i] = -1;
+long long endStage(struct Generator *gen, enum GenStage stage, long long stageStart) {
+    if (gen->stageNanos == NULL) {
+        return 0;
     }
+    long long now = monotonicNanos();
+    gen->stageNanos[stage] += now - stageStart;
+    return now;
 }
 
 /**
- * Fills a matrix with a specified character.
+ * Advances a splitmix64 state and returns its next output.
  *
- * This function takes a 2D character matrix, the number of rows and columns in the matrix,
- * and a character input. It fills the entire matrix with the specified character.
+ * Only used to expand seeds into well-mixed xoshiro states and level seeds.
  *
- * @param matrix The 2D character matrix to be filled.
- * @param rows The number of rows in the matrix.
- * @param cols The number of columns in the matrix.
- * @param input The character to fill the matrix with.
+ * @param state The splitmix64 state to advance.
+ * @return The next 64-bit output.
  */
-void fillMatrix(char matrix[][COLS], int rows, int cols, char input)
-{
-    int i, j;
+uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
 
-    for (i = 0; i < rows; i++)
-    {
-        for (j = 0; j < cols; j++)
-        {
-            matrix[i][j] = input;
-        }
-    }
+/**
+ * Derives the seed of level k of a run, in constant time.
+ *
+ * @param runSeed The seed of the whole run.
+ * @param levelIndex The index k of the level within the run.
+ * @return The seed to pass to generateLevel for that level.
+ */
+uint64_t levelSeed(uint64_t runSeed, uint64_t levelIndex) {
+    uint64_t state = runSeed ^ (levelIndex * 0xD1B54A32D192ED03ULL);
+    return splitmix64(&state);
 }
 
 /**
- * Prints a matrix to the console.
+ * Seeds one stream of a level's random numbers.
  *
- * This function takes a 2D character matrix, the number of rows and columns in the matrix,
- * and prints the matrix to the console.
+ * Each (seed, stream) pair gets its own unrelated xoshiro state, so the rooms,
+ * corridors and placement stages never share draws, and neighbouring seeds don't
+ * share any part of their streams.
  *
- * @param matrix The 2D character matrix to be printed.
- * @param rows The number of rows in the matrix.
- * @param cols The number of columns in the matrix.
+ * @param rng The generator state to seed.
+ * @param seed The level seed.
+ * @param stream Which stage the stream belongs to.
  */
-void printMatrix(char matrix[][COLS], int rows, int cols)
-{
-    int i, j;
+void rngSeed(struct Rng *rng, uint64_t seed, enum RngStream stream) {
+    uint64_t state = seed ^ ((uint64_t)(stream + 1) << 56);
+    uint64_t a = splitmix64(&state);
+    uint64_t b = splitmix64(&state);
+    rng->s[0] = (uint32_t)a;
+    rng->s[1] = (uint32_t)(a >> 32);
+    rng->s[2] = (uint32_t)b;
+    rng->s[3] = (uint32_t)(b >> 32);
+}
 
-    for (i = 0; i < rows; i++)
-    {
-        for (j = 0; j < cols; j++)
-        {
-            printf("%c ", matrix[i][j]);
-        }
-        printf("\n");
-    }
+uint32_t rotl32(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+/**
+ * Returns the next 32 random bits from a stream (xoshiro128**).
+ *
+ * @param rng The stream to draw from.
+ * @return The next random 32-bit value.
+ */
+uint32_t rngNext(struct Rng *rng) {
+    uint32_t *s = rng->s;
+    uint32_t result = rotl32(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl32(s[3], 11);
+    return result;
 }
 
 /**
- * Checks if a point is a door or floor tile.
+ * Returns a random number between 0 and n - 1.
  *
- * This function takes a 2D character matrix and a point, and checks if the character at the
- * specified point is a door, floor, or corridor tile.
+ * Uses a multiply and shift instead of %, so the result is the same on every
+ * platform and has no modulo bias worth speaking of for the small n used here.
  *
- * @param matrix The 2D character matrix to check.
- * @param point The point to check.
- * @return 1 if the character at the point is a door, floor, or corridor tile, 0 otherwise.
+ * @param rng The stream to draw from.
+ * @param n The number of possible results, must be at least 1.
+ * @return A random number in [0, n).
  */
-int pointIsDoorFloorOrCorridor(char matrix[][COLS], struct Point point) {
-    char c = matrix[point.y][point.x];
-    if (c == '%' || c == '.' || c == '#') {
-        return 1;
+int rngRange(struct Rng *rng, int n) {
+    return (int)(((uint64_t)rngNext(rng) * (uint32_t)n) >> 32);
+}
+
+/**
+ * Sets up an empty (all blank) tile map without allocating any chunks yet.
+ *
+ * @param map The map to initialize, release it with freeTileMap.
+ * @param rows The number of rows in the map.
+ * @param cols The number of columns in the map.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int initTileMap(struct TileMap *map, int rows, int cols) {
+    map->rows = rows;
+    map->cols = cols;
+    map->chunkCols = (cols + CHUNK_MASK) >> CHUNK_SHIFT;
+    map->chunkRows = (rows + CHUNK_MASK) >> CHUNK_SHIFT;
+    map->chunks = calloc((size_t)map->chunkRows * map->chunkCols, sizeof(unsigned char *));
+    map->allocatedChunks = 0;
+    return map->chunks != NULL;
+}
+
+void freeTileMap(struct TileMap *map) {
+    if (map->chunks == NULL) {
+        return;
     }
-    return 0;
+    for (int i = 0; i < map->chunkRows * map->chunkCols; i++) {
+        free(map->chunks[i]);
+    }
+    free(map->chunks);
+    map->chunks = NULL;
 }
 
 /**
- * Returns the destination point based on the player's current position and direction.
+ * Returns the tile at a position, TILE_BLANK anywhere nothing has been drawn.
  *
- * This function takes the player's current position and a direction, and returns the point
- * that the player would move to if they moved in that direction.
+ * @param map The map to read.
+ * @param x The column, must be inside the map.
+ * @param y The row, must be inside the map.
+ * @return The tile's enum TileType.
+ */
+int getTile(const struct TileMap *map, int x, int y) {
+    const unsigned char *chunk = map->chunks[(y >> CHUNK_SHIFT) * map->chunkCols + (x >> CHUNK_SHIFT)];
+    if (chunk == NULL) {
+        return TILE_BLANK;
+    }
+    int index = ((y & CHUNK_MASK) << CHUNK_SHIFT) | (x & CHUNK_MASK);
+    return (chunk[index >> 1] >> ((index & 1) << 2)) & 0xf;
+}
+
+/**
+ * Sets the tile at a position, allocating its chunk on the first non-blank write.
  *
- * @param playerPos The player's current position.
- * @param direction A char representing the direction the player wants to move in.
- * @return The point the player would move to if they moved in the specified direction.
+ * @param map The map to write.
+ * @param x The column, must be inside the map.
+ * @param y The row, must be inside the map.
+ * @param tile The tile's new enum TileType.
+ * @return 1 on success, 0 if the tile's chunk could not be allocated.
  */
-struct Point destinationPoint(struct Point playerPos, char direction)
-{
-    struct Point destination = playerPos;
-    if (direction == 'w')
-    {
-        destination.y--;
+int setTile(struct TileMap *map, int x, int y, int tile) {
+    unsigned char **chunk = &map->chunks[(y >> CHUNK_SHIFT) * map->chunkCols + (x >> CHUNK_SHIFT)];
+    if (*chunk == NULL) {
+        if (tile == TILE_BLANK) {
+            return 1; // already blank
+        }
+        *chunk = calloc(CHUNK_SIZE * CHUNK_SIZE / 2, 1);
+        if (*chunk == NULL) {
+            return 0;
+        }
+        map->allocatedChunks++;
     }
-    else if (direction == 'a')
-    {
-        destination.x--;
+    int index = ((y & CHUNK_MASK) << CHUNK_SHIFT) | (x & CHUNK_MASK);
+    int shift = (index & 1) << 2;
+    (*chunk)[index >> 1] = ((*chunk)[index >> 1] & ~(0xf << shift)) | (tile << shift);
+    return 1;
+}
+
+// Returns the character shown at a position: the player's if they stand there,
+// and floor where the treasure was, once a game has taken it out of its level
+char glyphAt(const struct Level *level, struct Point player, int x, int y) {
+    if (y == player.y && x == player.x) {
+        return PLAYER_CHAR;
     }
-    else if (direction == 's')
-    {
-        destination.y++;
+    int tile = getTile(&level->tiles, x, y);
+    if (tile == TILE_TREASURE && (x != level->treasureLocation.x || y != level->treasureLocation.y)) {
+        tile = TILE_FLOOR;
     }
-    else if (direction == 'd')
+    return tileGlyphs[tile];
+}
+
+/**
+ * Prints a level's map to the console, with the player drawn over whatever tile they stand on.
+ *
+ * @param level The level to be printed.
+ * @param player The player's location, or (-1, -1) to leave the player out.
+ */
+void printMatrix(const struct Level *level, struct Point player)
+{
+    const struct TileMap *map = &level->tiles;
+    int i, j;
+
+    for (i = 0; i < map->rows; i++)
     {
-        destination.x++;
+        for (j = 0; j < map->cols; j++)
+        {
+            printf("%c ", glyphAt(level, player, j, i));
+        }
+        printf("\n");
+    }
+}
+
+// What the player asks to do on a turn; the four moves are in wall order, so
+// ACTION_NORTH + d moves towards wall direction d
+enum Action {
+    ACTION_NONE, // a key that means nothing
+    ACTION_NORTH,
+    ACTION_EAST,
+    ACTION_SOUTH,
+    ACTION_WEST,
+    ACTION_QUIT,
+    ACTION_COUNT
+};
+
+// How far each action moves the player
+const int actionStepX[ACTION_COUNT] = {0, 0, 1, 0, -1, 0};
+const int actionStepY[ACTION_COUNT] = {0, -1, 0, 1, 0, 0};
+
+/**
+ * Maps a key to the action it stands for.
+ *
+ * @param key A character typed by the player: 'wasd' to move or 'q' to quit.
+ * @return The action, ACTION_NONE for any other key.
+ */
+enum Action actionFromKey(char key) {
+    switch (key) {
+        case 'w': return ACTION_NORTH;
+        case 'a': return ACTION_WEST;
+        case 's': return ACTION_SOUTH;
+        case 'd': return ACTION_EAST;
+        case 'q': return ACTION_QUIT;
+        default: return ACTION_NONE;
     }
-    return destination;
 }
 
 /// TODO: use pointInRect to determine if the player is in a room
@@ -262,18 +649,19 @@ int pointInRect(struct Rectangle rect, struct Point point) {
 
 
 /**
- * Places a room in the given matrix at the specified position with the specified dimensions.
+ * Places a room in the given map at the specified position with the specified dimensions.
  *
- * @param matrix The matrix to place the room in.
+ * @param map The map to place the room in.
  * @param x The x-coordinate of the top-left corner of the room.
  * @param y The y-coordinate of the top-left corner of the room.
  * @param width The width of the room.
  * @param height The height of the room.
- * @param wallChar The character used to represent the walls of the room.
+ * @return 1 on success, 0 if memory for the map could not be allocated.
  */
-void placeRoom(char matrix[][COLS], int x, int y, int width, int height, char wallChar)
+int placeRoom(struct TileMap *map, int x, int y, int width, int height)
 {
     int i, j;
+    int ok = 1;
 
     for (i = x; i < x + width; i++)
     {
@@ -281,357 +669,409 @@ void placeRoom(char matrix[][COLS], int x, int y, int width, int height, char wa
         {
             if (j == y || j == y + height - 1)
             {
-                matrix[j][i] = '-';
+                ok &= setTile(map, i, j, TILE_WALL_HORIZONTAL);
             }
             else if (i == x || i == x + width - 1)
             {
-                matrix[j][i] = '|';
+                ok &= setTile(map, i, j, TILE_WALL_VERTICAL);
             }
             else
             {
-                matrix[j][i] = '.';
+                ok &= setTile(map, i, j, TILE_FLOOR);
             }
         }
     }
+    return ok;
 }
 
 
 /**
- * Checks if a room exists in the specified quadrant.
+ * Sets up an empty room table for a grid of gridCols x gridRows cells.
  *
- * @param quadIndex The index of the quadrant to check.
- * @return 1 if a room exists in the quadrant, 0 otherwise.
+ * @param rooms The table to initialize, release it with freeRoomTable.
+ * @param count The number of rooms it will hold.
+ * @param gridCols The number of cells across the grid.
+ * @param gridRows The number of cells down the grid.
+ * @return 1 on success, 0 if memory could not be allocated.
  */
-int roomExists(int quadIndex) {
-    // printf("Checking room at quad %d to see if it exists... ", quadIndex);
-    if (quadrantsUsed[quadIndex] == -1) {
-        // printf("Room at quadIndex %d does not exist\n", quadIndex);
+int initRoomTable(struct RoomTable *rooms, int count, int gridCols, int gridRows) {
+    rooms->count = count;
+    rooms->gridCols = gridCols;
+    rooms->cells = gridCols * gridRows;
+    rooms->x = malloc(5 * count * sizeof(uint16_t));
+    rooms->roomOfQuadrant = malloc(rooms->cells * sizeof(int));
+    if (rooms->x == NULL || rooms->roomOfQuadrant == NULL) {
         return 0;
-    } else {
-        // printf("\n");
-        return 1;
     }
+    rooms->y = rooms->x + count;
+    rooms->width = rooms->y + count;
+    rooms->height = rooms->width + count;
+    rooms->quadrant = rooms->height + count;
+    for (int cell = 0; cell < rooms->cells; cell++) {
+        rooms->roomOfQuadrant[cell] = -1;
+    }
+    return 1;
 }
 
-int intMax(int a, int b) {
-    return (a > b) ? a : b;
+void freeRoomTable(struct RoomTable *rooms) {
+    free(rooms->x);
+    free(rooms->roomOfQuadrant);
+    rooms->x = NULL;
+    rooms->roomOfQuadrant = NULL;
 }
 
-// checks to see if a destination quad index is valid
-// pos refers to the current quad index
-// direction is a "shift" value that represents a cardinal direction to move in (see directionShifts array)
-// size is the size of the 1D quad matrix (in this case, 9)
-// note: This function is specific to a 3x3 grid
-int isValidQuadDestination(int currentPosition, int direction, int size) {
-    // Check bounds and special cases for left and right wrap-arounds
-    if (currentPosition + direction < 0 || currentPosition + direction >= size)
-        return 0;
-    if ((direction == -1 && currentPosition % 3 == 0) || 
-        (direction == 1 && (currentPosition + 1) % 3 == 0))
-        return 0;
-    return 1;
+// Returns room i of the table as a rectangle
+struct Rectangle roomRect(const struct RoomTable *rooms, int i) {
+    struct Rectangle rect = {rooms->x[i], rooms->y[i], rooms->width[i], rooms->height[i]};
+    return rect;
 }
 
-// 9 represents the size of the 3x3 grid and quantity of quadrants
-// breadth-first search used to check if all rooms are cardinally adjacent
-void bfs(int quads1dMatrix[], int visited[], int start) {
-    int queue[9];
-    int front = 0, rear = 0;
-
-    // Enqueue the starting index
-    queue[rear++] = start;
-    visited[start] = 1;
-
-    while (front < rear) {
-        int current = queue[front++];
-
-        // 4 possible directions to move in
-        for (int i = 0; i < 4; i++) {
-            int newPos = current + directionShifts[i];
-            
-            if (isValidQuadDestination(current, directionShifts[i], 9) && quads1dMatrix[newPos] != -1 && !visited[newPos]) {
-                visited[newPos] = 1;
-                queue[rear++] = newPos; // Enqueue the position
-            }
-        }
-    }
+int intMax(int a, int b) {
+    return (a > b) ? a : b;
 }
 
-// Checks if all rooms are cardinally adjacent
-int isCardinallyAdjacent(int quads1dMatrix[]) {
-
-    // debug 6
-    // print the quads1dMatrix
-    // printf("The quads1dMatrix is:\n");
-    // for (int i = 0; i < 9; i++) {
-    //     printf("%d ", quads1dMatrix[i]);
-    //     if((i+1) % 3 == 0) {
-    //         printf("\n");
-    //     }
-    // }
-    // printf("\n");
+/*
+Quadrant topology for the 3x3 grid. A set of quadrants is a 9-bit mask where bit i
+stands for quadrant i (0 top-left to 8 bottom-right, row by row), so neighbours of
+a whole set come from a few shifts, and connectivity from flood-filling bits.
 
-    int visited[9] = {0}; // MATRIX_SIZE
-    int start = -1;
-
-    // Find the first room
-    for (int i = 0; i < 9; i++) {
-        if (quads1dMatrix[i] != -1) {
-            start = i;
-            break;
-        }
-    }
+    0 1 2
+    3 4 5
+    6 7 8
+*/
+#define QUAD_ALL 0x1ff
+#define QUAD_LEFT_COLUMN 0x049 // quadrants 0, 3 and 6
+#define QUAD_RIGHT_COLUMN 0x124 // quadrants 2, 5 and 8
+
+// Each function returns the quadrants directly north/east/south/west of any quadrant in the mask
+int quadNorth(int mask) { return mask >> 3; }
+int quadEast(int mask) { return (mask << 1) & ~QUAD_LEFT_COLUMN & QUAD_ALL; }
+int quadSouth(int mask) { return (mask << 3) & QUAD_ALL; }
+int quadWest(int mask) { return (mask >> 1) & ~QUAD_RIGHT_COLUMN; }
+
+// Returns the quadrants cardinally adjacent to any quadrant in the mask
+int quadNeighbors(int mask) {
+    return quadNorth(mask) | quadEast(mask) | quadSouth(mask) | quadWest(mask);
+}
 
-    if (start == -1) {
-        printf("Error: no rooms found\n");
+/**
+ * Checks if all of the quadrants in a mask are cardinally connected to each other.
+ *
+ * Floods outward from the lowest quadrant one ring at a time, at most 8 rings.
+ *
+ * @param mask The quadrants holding rooms.
+ * @return 1 if the rooms form a single cardinally adjacent group, 0 otherwise.
+ */
+int quadIsConnected(int mask) {
+    if (mask == 0) {
         return 0;
     }
-
-    bfs(quads1dMatrix, visited, start);
-
-    // Check if all rooms were visited
-    for (int i = 0; i < 9; i++) {
-        if (quads1dMatrix[i] != -1 && !visited[i]) {
-            // printf("Not all rooms are cardinally adjacent\n");
-            return 0; // Not cardinally adjacent
-        }
+    int reached = mask & -mask;
+    int grown;
+    while ((grown = (reached | quadNeighbors(reached)) & mask) != reached) {
+        reached = grown;
     }
-
-    // printf("All rooms are cardinally adjacent\n");
-    return 1; // Cardinally adjacent
+    return reached == mask;
 }
 
-struct Rectangle *clearRooms(struct Rectangle *rooms, int numRooms) {
-    for (int i = 0; i < numRooms; i++) {
-        rooms[i].xPos = -1;
-        rooms[i].yPos = -1;
-        rooms[i].width = -1;
-        rooms[i].height = -1;
-        rooms[i].wallChar = -1;
+// The wall direction (0 North, 1 East, 2 South, 3 West) facing a cell from its
+// neighbour, looked up by (row delta + 1) * 3 + column delta + 1; -1 where the
+// cells are not cardinally adjacent
+const signed char wallFromCellDelta[9] = {-1, 0, -1, 3, -1, 1, -1, 2, -1};
+
+/**
+ * Returns which wall of the room in cell a faces the room in cell b.
+ *
+ * Cells are numbered row by row; the row and column deltas between them index
+ * wallFromCellDelta, so this works for a grid of any size.
+ *
+ * @param gridCols The number of cells across the grid.
+ * @param a The cell of the first room.
+ * @param b The cell of the second room.
+ * @return 0 North, 1 East, 2 South or 3 West, or -1 if the cells are not adjacent.
+ */
+int cellFacingWall(int gridCols, int a, int b) {
+    int rowDelta = b / gridCols - a / gridCols;
+    int colDelta = b % gridCols - a % gridCols;
+    if (rowDelta < -1 || rowDelta > 1 || colDelta < -1 || colDelta > 1) {
+        return -1;
     }
-    return rooms;
+    return wallFromCellDelta[(rowDelta + 1) * 3 + colDelta + 1];
 }
 
-struct Rectangle *placeRooms(char matrix[][COLS]) {
-    
-    struct Rectangle *rooms = malloc(numRooms * sizeof(struct Rectangle));
-    
-    // debugging
-    // printf("Initial quandrants used:\n");
-    // printQuadrantsUsed(quadrantsUsed);
-
-    // for(int i = 0; i < 9; i++) {
-    //     printf("%d\n", roomExists(i));
-    // }
+// Every connected layout of 5 to 9 rooms in the 3x3 quadrant grid, as 9-bit masks
+// where bit i is set when quadrant i holds a room, grouped by room count.
+// Sampling from this table means placeRooms never has to retry a layout.
+const unsigned short connectedLayouts[] = {
+    // 5 rooms: 49 layouts, starting at index 0
+    0x01f, 0x02f, 0x037, 0x03b, 0x03d, 0x03e, 0x04f, 0x05b, 0x05e, 0x079,
+    0x07a, 0x07c, 0x097, 0x09b, 0x09e, 0x0b3, 0x0b6, 0x0b9, 0x0ba, 0x0bc,
+    0x0cb, 0x0d3, 0x0d6, 0x0d9, 0x0da, 0x0f2, 0x0f4, 0x0f8, 0x127, 0x133,
+    0x136, 0x139, 0x13a, 0x13c, 0x178, 0x193, 0x196, 0x199, 0x19a, 0x1a6,
+    0x1b2, 0x1b4, 0x1b8, 0x1c9, 0x1d2, 0x1d8, 0x1e4, 0x1e8, 0x1f0,
+    // 6 rooms: 48 layouts, starting at index 49
+    0x03f, 0x05f, 0x06f, 0x07b, 0x07d, 0x07e, 0x09f, 0x0b7, 0x0bb, 0x0bd,
+    0x0be, 0x0cf, 0x0d7, 0x0db, 0x0de, 0x0f3, 0x0f6, 0x0f9, 0x0fa, 0x0fc,
+    0x12f, 0x137, 0x13b, 0x13d, 0x13e, 0x179, 0x17a, 0x17c, 0x197, 0x19b,
+    0x19e, 0x1a7, 0x1b3, 0x1b6, 0x1b9, 0x1ba, 0x1bc, 0x1cb, 0x1d3, 0x1d6,
+    0x1d9, 0x1da, 0x1e6, 0x1e9, 0x1ec, 0x1f2, 0x1f4, 0x1f8,
+    // 7 rooms: 32 layouts, starting at index 97
+    0x07f, 0x0bf, 0x0df, 0x0ef, 0x0f7, 0x0fb, 0x0fd, 0x0fe, 0x13f, 0x16f,
+    0x17b, 0x17d, 0x17e, 0x19f, 0x1af, 0x1b7, 0x1bb, 0x1bd, 0x1be, 0x1cf,
+    0x1d7, 0x1db, 0x1de, 0x1e7, 0x1eb, 0x1ed, 0x1ee, 0x1f3, 0x1f6, 0x1f9,
+    0x1fa, 0x1fc,
+    // 8 rooms: 9 layouts, starting at index 129
+    0x0ff, 0x17f, 0x1bf, 0x1df, 0x1ef, 0x1f7, 0x1fb, 0x1fd, 0x1fe,
+    // 9 rooms: 1 layouts, starting at index 138
+    0x1ff,
+};
 
-    int placing = 1;
-    
-    while(placing) {
+// Index of the first layout with n rooms in connectedLayouts, for n = 5..10
+const int connectedLayoutsStart[] = {0, 49, 97, 129, 138, 139};
 
-        int placed = 0;
-        int quadChar = '0';
+/**
+ * Picks a random connected quadrant layout with the given number of rooms.
+ *
+ * @param rng The stream to draw from.
+ * @param numRooms The number of rooms, between 5 and 9.
+ * @return The index of the layout in connectedLayouts.
+ */
+int randomConnectedLayout(struct Rng *rng, int numRooms) {
+    int first = connectedLayoutsStart[numRooms - 5];
+    int count = connectedLayoutsStart[numRooms - 4] - first;
+    return first + rngRange(rng, count);
+}
 
-        for (int i = 0; i < 9; i++) {
-            quadrantsUsed[i] = -1; // reset used quadrants
-        }
+/**
+ * Picks a random connected set of cells for the rooms on a grid of any size.
+ *
+ * Grows outward from a random cell, each step adding a random cell from the
+ * frontier of cells next to the ones already chosen. Chosen cells are set to 0
+ * in roomOfQuadrant and every other cell to -1.
+ *
+ * @param gen The generator whose grid and room stream to use.
+ * @param rooms The room table to mark the chosen cells in.
+ * @param numRooms The number of cells to choose, at most gridCols * gridRows.
+ */
+void growConnectedLayout(struct Generator *gen, struct RoomTable *rooms, int numRooms) {
+    int gridCols = gen->gridCols;
+    int cells = gridCols * gen->gridRows;
+    int *frontier = gen->cellScratch; // may repeat cells, but each chosen cell adds at most 4
+    int frontierSize = 0;
+    int chosen = 0;
+
+    for (int cell = 0; cell < cells; cell++) {
+        rooms->roomOfQuadrant[cell] = -1;
+    }
 
-        while (placed < numRooms) {
-            int quadrant = rand() % 9;
-            while (quadrantsUsed[quadrant] != -1) { // Find an unused quadrant
-                quadrant = (quadrant + 1) % 9;
+    int cell = rngRange(&gen->roomsRng, cells);
+    while (1) {
+        if (rooms->roomOfQuadrant[cell] == -1) {
+            rooms->roomOfQuadrant[cell] = 0;
+            if (++chosen == numRooms) {
+                break;
             }
+            if (cell >= gridCols && rooms->roomOfQuadrant[cell - gridCols] == -1) {
+                frontier[frontierSize++] = cell - gridCols;
+            }
+            if ((cell + 1) % gridCols != 0 && rooms->roomOfQuadrant[cell + 1] == -1) {
+                frontier[frontierSize++] = cell + 1;
+            }
+            if (cell + gridCols < cells && rooms->roomOfQuadrant[cell + gridCols] == -1) {
+                frontier[frontierSize++] = cell + gridCols;
+            }
+            if (cell % gridCols != 0 && rooms->roomOfQuadrant[cell - 1] == -1) {
+                frontier[frontierSize++] = cell - 1;
+            }
+        }
+        int pick = rngRange(&gen->roomsRng, frontierSize);
+        cell = frontier[pick];
+        frontier[pick] = frontier[--frontierSize];
+    }
+}
 
-            int thirdWidth = COLS / 3;
-            int thirdHeight = ROWS / 3;
-
-            int xStart = quadrant % 3 * thirdWidth + 1; // Calculate quadrant position
-            int yStart = quadrant / 3 * thirdHeight + 1;
-
-            int maxWidth = thirdWidth - 2; // 2 tiles less than a third of the map's dimensions
-            int maxHeight = thirdHeight - 2;
-
-            // printf("maxWidth: %d, maxHeight: %d\n", maxWidth, maxHeight);
-
-            int width = rand() % (maxWidth - 5 + 1) + 5; // Room size between 5x5 and maxWidth x maxHeight
-            int height = rand() % (maxHeight - 5 + 1) + 5;
+/**
+ * Picks which cells hold rooms, then places a randomly sized room in each.
+ *
+ * Rooms are numbered in cell order, row by row.
+ *
+ * @param gen The generator whose grid, room count and random state to use.
+ * @param map The game map.
+ * @param rooms The table to fill in, set up by initRoomTable for gen->numRooms rooms.
+ * @return 1 on success, 0 if memory for the map could not be allocated.
+ */
+int placeRooms(struct Generator *gen, struct TileMap *map, struct RoomTable *rooms) {
+    
+    int numRooms = gen->numRooms;
+    int cells = gen->gridCols * gen->gridRows;
+    int placed = 0;
 
-            // printf("width: %d, height: %d\n", width, height);
+    if (gen->gridCols == 3 && gen->gridRows == 3) {
+        // draw a layout that is already known to be cardinally adjacent, so the
+        // rooms are placed exactly once
+        gen->layoutIndex = randomConnectedLayout(&gen->roomsRng, numRooms);
+        int layout = connectedLayouts[gen->layoutIndex];
+        for (int quadrant = 0; quadrant < 9; quadrant++) {
+            rooms->roomOfQuadrant[quadrant] = (layout & (1 << quadrant)) ? 0 : -1;
+        }
+    } else {
+        gen->layoutIndex = -1;
+        growConnectedLayout(gen, rooms, numRooms);
+    }
 
-            // Ensure the room doesn't go out of its quadrant
-            int x = xStart + rand() % intMax((thirdWidth - width - 2), 1);
-            int y = yStart + rand() % intMax((thirdHeight - height - 2), 1);
+    int cellWidth = map->cols / gen->gridCols;
+    int cellHeight = map->rows / gen->gridRows;
 
-            // printf("x: %d, y: %d\n", x, y);
+    for (int quadrant = 0; quadrant < cells; quadrant++) {
+        if (rooms->roomOfQuadrant[quadrant] == -1) {
+            continue;
+        }
 
-            quadChar = '0' + quadrant;
+        int xStart = quadrant % gen->gridCols * cellWidth + 1; // Calculate quadrant position
+        int yStart = quadrant / gen->gridCols * cellHeight + 1;
 
-            // printf("Placing room %d in quadrant %d at (%d, %d) with size %dx%d\n", placed, quadrant, x, y, width, height);
-            struct Rectangle c = {x, y, width, height, quadChar};
-            placeRoom(matrix, x, y, width, height, quadChar); // Place room on map
-            rooms[placed] = c;
-            quadrantsUsed[quadrant] = placed; // Mark this quadrant as used
-            placed++;
-        }
+        int maxWidth = cellWidth - 2; // 2 tiles less than the cell's dimensions
+        int maxHeight = cellHeight - 2;
 
+        int width = rngRange(&gen->roomsRng, maxWidth - 5 + 1) + 5; // Room size between 5x5 and maxWidth x maxHeight
+        int height = rngRange(&gen->roomsRng, maxHeight - 5 + 1) + 5;
 
-        if(isCardinallyAdjacent(quadrantsUsed)) {
-            // printf("2. Rooms are cardinally adjacent, breaking the placing loop...\n");
-            placing = 0;
-        } else {
+        // Ensure the room doesn't go out of its quadrant
+        int x = xStart + rngRange(&gen->roomsRng, intMax((cellWidth - width - 2), 1));
+        int y = yStart + rngRange(&gen->roomsRng, intMax((cellHeight - height - 2), 1));
 
-            // debugging
-            // printMatrix(matrix, ROWS, COLS);
-            fillMatrix(matrix, ROWS, COLS, ' '); // Clear the matrix of the previously drawn rooms
-            epochs++;
-            // printf("2. Rooms are not cardinally adjacent, trying again...\n");
-            // increment random seed to get different room placements
-            randomSeed++;
-            // fixedSeed++;
-            // printf("New random seed: %d\n", randSeed);
-            // srand(fixedSeed);
-            srand(randomSeed);
-            rooms = clearRooms(rooms, numRooms);
+        // printf("Placing room %d in quadrant %d at (%d, %d) with size %dx%d\n", placed, quadrant, x, y, width, height);
+        if (!placeRoom(map, x, y, width, height)) { // Place room on map
+            return 0;
         }
+        rooms->x[placed] = x;
+        rooms->y[placed] = y;
+        rooms->width[placed] = width;
+        rooms->height[placed] = height;
+        rooms->quadrant[placed] = quadrant;
+        rooms->roomOfQuadrant[quadrant] = placed; // Mark this quadrant as used
+        placed++;
     }
-    
-    // debugging
-    // printf("Final quandrants used:\n");
-    // printQuadrantsUsed(quadrantsUsed);
-
-    // for(int i = 0; i < 9; i++) {
-    //     printf("%d\n", roomExists(i));
-    // }
-
-    return rooms;
+    return 1;
 }
 
-void redrawAllRooms(char matrix[][COLS], struct Rectangle *rooms, int numRooms) {
-    for (int i = 0; i < numRooms; i++) {
-        // placeRoom(matrix, rooms[i].xPos+1, rooms[i].yPos+1, rooms[i].width-2, rooms[i].height-2, i + '0');
-        placeRoom(matrix, rooms[i].xPos, rooms[i].yPos, rooms[i].width, rooms[i].height, rooms[i].wallChar);
+int redrawAllRooms(struct TileMap *map, const struct RoomTable *rooms) {
+    int ok = 1;
+    for (int i = 0; i < rooms->count; i++) {
+        ok &= placeRoom(map, rooms->x[i], rooms->y[i], rooms->width[i], rooms->height[i]);
     }
+    return ok;
 }
 
 
 /**
- * Finds the top-left room in the given array of rooms.
+ * Finds the top-left room, the one whose corner is nearest the map's corner.
  *
- * @param rooms     Pointer to an array of Rectangle structures representing rooms.
- * @param numRooms  The number of rooms in the array.
- * @return          The top-left room in the array.
+ * The distances are found in one pass over the packed x and y arrays, so the
+ * compiler can vectorize it, and the first room at that distance in another.
+ *
+ * @param rooms The room table to search.
+ * @return The index of the top-left room, the lowest index on a tie, or -1 if there are no rooms.
  */
-struct Rectangle findTopLeftRoom(struct Rectangle *rooms, int numRooms) {
-    if(numRooms == 0) {
+int findTopLeftRoom(const struct RoomTable *rooms) {
+    if(rooms->count == 0) {
         printf("Error: no rooms, cannot locate top left room\n");
-        struct Rectangle noRoom = {-1, -1, -1, -1};
-        return noRoom;
+        return -1;
     }
 
-    struct Rectangle topLeftRoom = rooms[0];
-    int minDistance = rooms[0].xPos + rooms[0].yPos;
+    int minDistance = rooms->x[0] + rooms->y[0];
+    for (int i = 1; i < rooms->count; i++) {
+        int distance = rooms->x[i] + rooms->y[i];
+        minDistance = distance < minDistance ? distance : minDistance;
+    }
 
-    for (int i = 1; i < numRooms; i++) {
-        int distance = rooms[i].xPos + rooms[i].yPos;
-        if (distance < minDistance) {
-            topLeftRoom = rooms[i];
-            minDistance = distance;
-        }
+    int topLeftRoom = 0;
+    while (rooms->x[topLeftRoom] + rooms->y[topLeftRoom] != minDistance) {
+        topLeftRoom++;
     }
 
     // debug 8
-    // printf("The top left room is at (%d, %d)\n", topLeftRoom.xPos, topLeftRoom.yPos);
+    // printf("The top left room is at (%d, %d)\n", rooms->x[topLeftRoom], rooms->y[topLeftRoom]);
     return topLeftRoom;
 }
 
 /**
- * Retrieves the index of the room that intersects with the given rectangle.
+ * Builds the room graph from the corridor ends placeCorridors recorded.
  *
- * @param rect The rectangle to check for intersection.
- * @param rooms An array of rectangles representing the rooms.
- * @param numRooms The number of rooms in the array.
- * @return The index of the intersecting room, or -1 if no intersection is found.
- */
-int getRoomIndexFromRect(struct Rectangle rect, struct Rectangle *rooms, int numRooms) {
-    for (int i = 0; i < numRooms; i++) {
-        if (rooms[i].xPos == rect.xPos && rooms[i].yPos == rect.yPos) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-
-
-/**
- * Performs a depth-first search starting from a given room.
+ * A counting sort: count each room's corridors, turn the counts into offsets,
+ * then drop every corridor's far room into place. No corridor is listed twice,
+ * since each pair of rooms gets at most one.
  *
- * @param room The starting room for the search.
- * @param numRooms The total number of rooms in the map.
- * @param connections[][numRooms] A 2D array representing the connections between rooms.
- * @param visited[] An array indicating whether a room has been visited or not.
+ * @param graph The graph to fill in, release it with freeRoomGraph.
+ * @param numRooms The number of rooms, at most 65536.
+ * @param corridorEnds Both ends of every corridor, end 2i and 2i + 1 belonging to corridor i.
+ * @param numCorridors The number of corridors.
+ * @return 1 on success, 0 if memory could not be allocated.
  */
-void dfs(int room, int numRooms, int connections[][numRooms], int visited[]) {
-    visited[room] = 1;
-
-    for (int i = 0; i < numRooms; i++) {
-        if (connections[room][i] && !visited[i]) {
-            dfs(i, numRooms, connections, visited);
-        }
+int buildRoomGraph(struct RoomGraph *graph, int numRooms, struct CorridorEnd *corridorEnds, int numCorridors) {
+    graph->numRooms = numRooms;
+    graph->offsets = calloc(numRooms + 1, sizeof(int));
+    graph->neighbors = malloc((2 * numCorridors + 1) * sizeof(uint16_t));
+    if (graph->offsets == NULL || graph->neighbors == NULL) {
+        return 0;
     }
-}
 
-/**
- * Determines if the given graph of rooms is fully transitive.
- *
- * @param numRooms The number of rooms in the graph.
- * @param connections The adjacency matrix representing the connections between rooms.
- *                    The value at connections[i][j] indicates whether there is a connection
- *                    between room i and room j (1 if connected, 0 otherwise).
- * @return 1 if the graph is fully transitive, 0 otherwise.
- */
-int isFullyTransitive(int numRooms, int connections[][numRooms]) {
-    int visited[numRooms];
+    for (int i = 0; i < 2 * numCorridors; i++) {
+        graph->offsets[corridorEnds[i].room + 1]++;
+    }
     for (int i = 0; i < numRooms; i++) {
-        visited[i] = 0;
+        graph->offsets[i + 1] += graph->offsets[i];
     }
-
-    // Start DFS from the first room
-    dfs(0, numRooms, connections, visited);
-
-    // Check if all rooms were visited
+    // fill each room's slots from its end backwards, which leaves offsets[room + 1] at the room's start
+    for (int i = 2 * numCorridors - 1; i >= 0; i--) {
+        int room = corridorEnds[i].room;
+        graph->neighbors[--graph->offsets[room + 1]] = corridorEnds[i ^ 1].room;
+    }
+    // shift the starts down one place
     for (int i = 0; i < numRooms; i++) {
-        if (!visited[i]) {
-            return 0; // Not fully transitive
-        }
+        graph->offsets[i] = graph->offsets[i + 1];
     }
+    graph->offsets[numRooms] = 2 * numCorridors;
+    return 1;
+}
 
-    return 1; // Fully transitive
+void freeRoomGraph(struct RoomGraph *graph) {
+    free(graph->offsets);
+    free(graph->neighbors);
+    graph->offsets = NULL;
+    graph->neighbors = NULL;
 }
 
+// Returns the number of corridors leading out of a room
+int roomDegree(const struct RoomGraph *graph, int room) {
+    return graph->offsets[room + 1] - graph->offsets[room];
+}
 
 /**
  * Calculates the farthest room from the given start room index.
  *
  * @param startRoomIndex The index of the start room.
- * @param numRooms The total number of rooms.
- * @param connections The 2D array representing the connections between rooms.
+ * @param graph The corridors between rooms.
+ * @param scratch Working space for 2 * graph->numRooms ints.
  * @return The index of the farthest room from the start room.
  */
-int farthestRoom(int startRoomIndex, int numRooms, int connections[][numRooms]) {
-    int distances[numRooms];
+int farthestRoom(int startRoomIndex, const struct RoomGraph *graph, int *scratch) {
+    int numRooms = graph->numRooms;
+    int *distances = scratch;
     for (int i = 0; i < numRooms; i++) {
         distances[i] = -1;
     }
     distances[startRoomIndex] = 0;
 
-    int queue[numRooms];
+    int *queue = scratch + numRooms;
     int front = 0, back = 0;
     queue[back++] = startRoomIndex;
 
     while (front != back) {
         int currentRoom = queue[front++];
-        for (int i = 0; i < numRooms; i++) {
-            if (connections[currentRoom][i] && distances[i] == -1) {
+        for (int e = graph->offsets[currentRoom]; e < graph->offsets[currentRoom + 1]; e++) {
+            int i = graph->neighbors[e];
+            if (distances[i] == -1) {
                 distances[i] = distances[currentRoom] + 1;
                 queue[back++] = i;
             }
@@ -649,360 +1089,926 @@ int farthestRoom(int startRoomIndex, int numRooms, int connections[][numRooms])
     return farthestRoomIndex;
 }
 
-// Simplified adjacency for a 3x3 grid, index 0-8 from top-left to bottom-right
-int adjacentSimple[9][9] = {
-    {-1, 1, -1, 3, -1, -1, -1, -1, -1}, // quad 0 is adjacent to quads 1, 3
-    {0, -1, 2, -1, 4, -1, -1, -1, -1}, // quad 1 is adjacent to quads 0, 2, and 4
-    {-1, 1, -1, -1, -1, 5, -1, -1, -1}, // quad 2 is adjacent to quads 1 and 5
-    {0, -1, -1, -1, 4, -1, 6, -1, -1}, // quad 3 is adjacent to quads 0, 4, and 6
-    {-1, 1, -1, 3, -1, 5, -1, 7, -1}, // quad 4 is adjacent to quads 1, 3, 5, and 7
-    {-1, -1, 2, -1, 4, -1, -1, -1, 8}, // quad 5 is adjacent to quads 2, 4, and 8
-    {-1, -1, -1, 3, -1, -1, -1, 7, -1}, // quad 6 is adjacent to quads 3 and 7
-    {-1, -1, -1, -1, 4, -1, 6, -1, 8}, // quad 7 is adjacent to quads 6, 4, and 8 
-    {-1, -1, -1, -1, -1, 5, -1, 7, -1} // quad 8 is adjacent to quads 5 and 7
-};
-
-/**
- * Checks if two rooms are adjacent to each other.
- *
- * @param room1Index The index of the first room.
- * @param room2Index The index of the second room.
- * @return 1 if the rooms are adjacent, 0 otherwise.
- */
-int areAdjacentSimple(int room1Index, int room2Index) {
-    if(room1Index < 0 || room1Index > 8 || room2Index < 0 || room2Index > 8) {
-        // printf("Error: rooms %d and %d are out of bounds\n", room1Index, room2Index);
-        return -1;
-    }
-    return adjacentSimple[room1Index][room2Index];
-}
-
-
-// Simplified neighbors for a 3x3 grid, index 0-8 from top-left to bottom-right
-// takes results and populates neighborsSimple array, which must be cleared after use
-void calculateNeighborsSimple(int roomIndex) {
-    int upShift = roomIndex - 3;
-    int rightShift = roomIndex + 1;
-    int downShift = roomIndex + 3;
-    int leftShift = roomIndex - 1;
-    neighborsSimple[0] = areAdjacentSimple(roomIndex, upShift) != -1 ? upShift : -1;
-    neighborsSimple[1] = areAdjacentSimple(roomIndex, rightShift) != -1 ? rightShift : -1;
-    neighborsSimple[2] = areAdjacentSimple(roomIndex, downShift) != -1 ? downShift : -1;
-    neighborsSimple[3] = areAdjacentSimple(roomIndex, leftShift) != -1 ? leftShift : -1;
-}
-
-char* directionsSimple[4] = {"North", "East", "South", "West"};
-
-// Returns the direction of the wall that connects two rooms
-int getFacingWallDirectionSimple(int room1Index, int room2Index) {
-    int direction = areAdjacentSimple(room1Index, room2Index);
-    if (direction == -1) {
-        printf("Error: rooms %d and %d are not adjacent\n", room1Index, room2Index);
-        return -1;
-    }
-    for(int i = 0; i < 8; i++) {
-        if(neighborsSimple[i] == room2Index) {
-            // debug 2
-            // printf(">>> The wall of room %d that connects to room %d is on the %s\n", room1Index, room2Index, directionsSimple[i]);
-            direction = i;
-        }
-    }
-    return direction;
-}
-
 // function used to determine where corridors connect to each room
-struct Point *getRandomPointOnWall(struct Rectangle room, int direction) {
-    struct Point *point = (struct Point *)malloc(1 * sizeof(struct Point));
+struct Point getRandomPointOnWall(struct Generator *gen, struct Rectangle room, int direction) {
+    struct Point point;
     
     switch (direction) {
         case 0: // North
-            (*point).x = room.xPos + 1 + rand() % (room.width - 2);
-            (*point).y = room.yPos - 1;
+            point.x = room.xPos + 1 + rngRange(&gen->corridorsRng, room.width - 2);
+            point.y = room.yPos - 1;
             break;
         case 1: // East
-            (*point).x = room.xPos + room.width;
-            (*point).y = room.yPos + 1 + rand() % (room.height - 2);
+            point.x = room.xPos + room.width;
+            point.y = room.yPos + 1 + rngRange(&gen->corridorsRng, room.height - 2);
             break;
         case 2: // South
-            (*point).x = room.xPos + 1 + rand() % (room.width - 2);
-            (*point).y = room.yPos + room.height;
+            point.x = room.xPos + 1 + rngRange(&gen->corridorsRng, room.width - 2);
+            point.y = room.yPos + room.height;
             break;
         case 3: // West
-            (*point).x = room.xPos - 1;
-            (*point).y = room.yPos + 1 + rand() % (room.height - 2);
+            point.x = room.xPos - 1;
+            point.y = room.yPos + 1 + rngRange(&gen->corridorsRng, room.height - 2);
             break;
         default:
             // Invalid direction
             printf("&&& Error: invalid direction %d\n", direction);
-            (*point).x = -1;
-            (*point).y = -1;
+            point.x = -1;
+            point.y = -1;
             break;
     }
     return point;
 }
 
 
-// debugging function to print the connections matrix
-void printConnections(int numRooms, int connections[][numRooms]) {
-    for (int i = 0; i < numRooms; i++) {
-        for (int j = 0; j < numRooms; j++) {
-            printf("%d ", connections[i][j]);
+// debugging function to print the rooms each room is connected to
+void printConnections(const struct RoomGraph *graph) {
+    for (int i = 0; i < graph->numRooms; i++) {
+        printf("%d:", i);
+        for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+            printf(" %d", graph->neighbors[e]);
         }
         printf("\n");
     }
 }
 
 
-/// TODO: update placeCorridors function to return a 2D array of points representing the corridors instead of rectangles
 /**
- * Places corridors between rooms in the given matrix.
+ * Union-find (disjoint set) over room indices.
  *
- * @param matrix The 2D array representing the game map.
- * @param rooms An array of Rectangle structures representing the rooms.
- * @param numRooms The number of rooms in the game map.
- * @param connections A 2D array representing the connections between rooms.
- *                    Each row corresponds to a room, and each column represents a connection to another room.
- *                    The value at connections[i][j] is 1 if there is a connection between room i and room j, and 0 otherwise.
- * @return A pointer to the updated array of Rectangle structures representing the rooms.
+ * Rooms in the same set are already connected to each other through corridors,
+ * and components counts the sets, so "is every room reachable yet?" is a single
+ * comparison no matter how many rooms there are.
  */
-struct Rectangle *placeCorridors(char matrix[][COLS], struct Rectangle *rooms, int numRooms, int connections[][numRooms]) {
-    // srand(time(NULL));
+struct UnionFind {
+    int *parent;
+    int *size;
+    int components;
+};
 
-    /// TODO: assess whether numRooms is a good cap on corridors
-    struct Rectangle *corridors = malloc(numRooms * sizeof(struct Rectangle));
-    int placed = 0;
-    char pathLetter = '#'; // 'a' or '1' for testing / '#'
+void freeUnionFind(struct UnionFind *uf) {
+    free(uf->parent);
+    free(uf->size);
+}
 
-    // initialize connections to all 0's to indicate there are no room connections yet
-        for (int i = 0; i < numRooms; i++) {
-            for (int j = 0; j < numRooms; j++) {
-                connections[i][j] = 0;
-            }
-        }
+/**
+ * Starts a union-find with every room in a set of its own.
+ *
+ * @param uf The union-find to initialize, release it with freeUnionFind.
+ * @param numRooms The number of rooms.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int initUnionFind(struct UnionFind *uf, int numRooms) {
+    uf->parent = malloc(numRooms * sizeof(int));
+    uf->size = malloc(numRooms * sizeof(int));
+    if (uf->parent == NULL || uf->size == NULL) {
+        freeUnionFind(uf);
+        return 0;
+    }
+    uf->components = numRooms;
+    for (int i = 0; i < numRooms; i++) {
+        uf->parent[i] = i;
+        uf->size[i] = 1;
+    }
+    return 1;
+}
 
-    // debugging 6
-    // printf("=========\n");
-    // printf("before connecting the corridors the connections are:\n");
-    // printConnections(numRooms, connections); // MAX_ROOM_COUNT
-    // printf("=========\n");
+/**
+ * Finds the representative room of a room's set, compressing the path on the way.
+ *
+ * @param uf The union-find to search.
+ * @param room The room index.
+ * @return The index of the room that represents the set.
+ */
+int findSet(struct UnionFind *uf, int room) {
+    while (uf->parent[room] != room) {
+        uf->parent[room] = uf->parent[uf->parent[room]]; // path halving
+        room = uf->parent[room];
+    }
+    return room;
+}
+
+/**
+ * Merges the sets of two rooms, the smaller set joining the larger one.
+ *
+ * @param uf The union-find to update.
+ * @param room1 The first room index.
+ * @param room2 The second room index.
+ * @return 1 if the rooms were not connected before, 0 otherwise.
+ */
+int unionSets(struct UnionFind *uf, int room1, int room2) {
+    int root1 = findSet(uf, room1);
+    int root2 = findSet(uf, room2);
+    if (root1 == root2) {
+        return 0;
+    }
+    if (uf->size[root1] < uf->size[root2]) {
+        int swap = root1;
+        root1 = root2;
+        root2 = swap;
+    }
+    uf->parent[root2] = root1;
+    uf->size[root1] += uf->size[root2];
+    uf->components--;
+    return 1;
+}
+
+// The 12 possible corridors of the 3x3 grid as pairs of quadrants, bit i of a
+// corridor set stands for corridorEdges[i]. Each pair faces a single wall of
+// each room, so any set of them keeps to one corridor per wall.
+const unsigned char corridorEdges[12][2] = {
+    {0, 1}, {1, 2}, {3, 4}, {4, 5}, {6, 7}, {7, 8}, // east-west
+    {0, 3}, {1, 4}, {2, 5}, {3, 6}, {4, 7}, {5, 8}  // north-south
+};
+
+// For every layout in connectedLayouts, every corridor set that connects all of
+// its rooms and that the old pick-two-rooms-until-connected loop could end on
+// (connected, with at least one corridor whose removal disconnects it),
+// as 12-bit masks over corridorEdges. The layout's mask leads each group.
+const unsigned short corridorSets[] = {
+    /* 0x01f */ 0x047, 0x087, 0x0c3, 0x0c6, 0x0c7,
+    /* 0x02f */ 0x143,
+    /* 0x037 */ 0x08b, 0x10b, 0x183, 0x189, 0x18b,
+    /* 0x03b */ 0x04d, 0x08d, 0x0c9, 0x0cc, 0x0cd,
+    /* 0x03d */ 0x14c,
+    /* 0x03e */ 0x08e, 0x10e, 0x186, 0x18c, 0x18e,
+    /* 0x04f */ 0x243,
+    /* 0x05b */ 0x245, 0x285, 0x2c1, 0x2c4, 0x2c5,
+    /* 0x05e */ 0x286,
+    /* 0x079 */ 0x24c,
+    /* 0x07a */ 0x28c,
+    /* 0x07c */ 0x30c,
+    /* 0x097 */ 0x483,
+    /* 0x09b */ 0x445, 0x485, 0x4c1, 0x4c4, 0x4c5,
+    /* 0x09e */ 0x486,
+    /* 0x0b3 */ 0x489,
+    /* 0x0b6 */ 0x48a, 0x50a, 0x582, 0x588, 0x58a,
+    /* 0x0b9 */ 0x44c,
+    /* 0x0ba */ 0x48c,
+    /* 0x0bc */ 0x50c,
+    /* 0x0cb */ 0x251,
+    /* 0x0d3 */ 0x491,
+    /* 0x0d6 */ 0x492,
+    /* 0x0d9 */ 0x254, 0x454, 0x644, 0x650, 0x654,
+    /* 0x0da */ 0x294, 0x494, 0x684, 0x690, 0x694,
+    /* 0x0f2 */ 0x498,
+    /* 0x0f4 */ 0x518,
+    /* 0x0f8 */ 0x21c, 0x41c, 0x60c, 0x618, 0x61c,
+    /* 0x127 */ 0x903,
+    /* 0x133 */ 0x889,
+    /* 0x136 */ 0x88a, 0x90a, 0x982, 0x988, 0x98a,
+    /* 0x139 */ 0x84c,
+    /* 0x13a */ 0x88c,
+    /* 0x13c */ 0x90c,
+    /* 0x178 */ 0xa0c,
+    /* 0x193 */ 0x4a1,
+    /* 0x196 */ 0x4a2,
+    /* 0x199 */ 0x464,
+    /* 0x19a */ 0x4a4,
+    /* 0x1a6 */ 0x922,
+    /* 0x1b2 */ 0x4a8, 0x8a8, 0xc88, 0xca0, 0xca8,
+    /* 0x1b4 */ 0x528, 0x928, 0xd08, 0xd20, 0xd28,
+    /* 0x1b8 */ 0x42c, 0x82c, 0xc0c, 0xc24, 0xc2c,
+    /* 0x1c9 */ 0x270,
+    /* 0x1d2 */ 0x4b0,
+    /* 0x1d8 */ 0x234, 0x434, 0x624, 0x630, 0x634,
+    /* 0x1e4 */ 0x930,
+    /* 0x1e8 */ 0xa30,
+    /* 0x1f0 */ 0x438, 0x838, 0xc18, 0xc30, 0xc38,
+    /* 0x03f */ 0x04f, 0x08f, 0x0cb, 0x0ce, 0x0cf, 0x10f, 0x147, 0x14b, 0x14d, 0x14e,
+                 0x187, 0x18d, 0x18f, 0x1c3, 0x1c6, 0x1c7, 0x1c9, 0x1cb, 0x1cc, 0x1cd,
+                 0x1ce,
+    /* 0x05f */ 0x247, 0x287, 0x2c3, 0x2c6, 0x2c7,
+    /* 0x06f */ 0x343,
+    /* 0x07b */ 0x24d, 0x28d, 0x2c9, 0x2cc, 0x2cd,
+    /* 0x07d */ 0x34c,
+    /* 0x07e */ 0x28e, 0x30e, 0x386, 0x38c, 0x38e,
+    /* 0x09f */ 0x447, 0x487, 0x4c3, 0x4c6, 0x4c7,
+    /* 0x0b7 */ 0x48b, 0x50b, 0x583, 0x589, 0x58b,
+    /* 0x0bb */ 0x44d, 0x48d, 0x4c9, 0x4cc, 0x4cd,
+    /* 0x0bd */ 0x54c,
+    /* 0x0be */ 0x48e, 0x50e, 0x586, 0x58c, 0x58e,
+    /* 0x0cf */ 0x253,
+    /* 0x0d7 */ 0x493,
+    /* 0x0db */ 0x255, 0x295, 0x2d1, 0x2d4, 0x2d5, 0x455, 0x495, 0x4d1, 0x4d4, 0x4d5,
+                 0x645, 0x651, 0x655, 0x685, 0x691, 0x695, 0x6c1, 0x6c4, 0x6c5, 0x6d0,
+                 0x6d4,
+    /* 0x0de */ 0x296, 0x496, 0x686, 0x692, 0x696,
+    /* 0x0f3 */ 0x499,
+    /* 0x0f6 */ 0x49a, 0x51a, 0x592, 0x598, 0x59a,
+    /* 0x0f9 */ 0x25c, 0x45c, 0x64c, 0x658, 0x65c,
+    /* 0x0fa */ 0x29c, 0x49c, 0x68c, 0x698, 0x69c,
+    /* 0x0fc */ 0x31c, 0x51c, 0x70c, 0x718, 0x71c,
+    /* 0x12f */ 0x943,
+    /* 0x137 */ 0x88b, 0x90b, 0x983, 0x989, 0x98b,
+    /* 0x13b */ 0x84d, 0x88d, 0x8c9, 0x8cc, 0x8cd,
+    /* 0x13d */ 0x94c,
+    /* 0x13e */ 0x88e, 0x90e, 0x986, 0x98c, 0x98e,
+    /* 0x179 */ 0xa4c,
+    /* 0x17a */ 0xa8c,
+    /* 0x17c */ 0xb0c,
+    /* 0x197 */ 0x4a3,
+    /* 0x19b */ 0x465, 0x4a5, 0x4e1, 0x4e4, 0x4e5,
+    /* 0x19e */ 0x4a6,
+    /* 0x1a7 */ 0x923,
+    /* 0x1b3 */ 0x4a9, 0x8a9, 0xc89, 0xca1, 0xca9,
+    /* 0x1b6 */ 0x4aa, 0x52a, 0x5a2, 0x5a8, 0x5aa, 0x8aa, 0x92a, 0x9a2, 0x9a8, 0x9aa,
+                 0xc8a, 0xca2, 0xcaa, 0xd0a, 0xd22, 0xd2a, 0xd82, 0xd88, 0xd8a, 0xda0,
+                 0xda8,
+    /* 0x1b9 */ 0x46c, 0x86c, 0xc4c, 0xc64, 0xc6c,
+    /* 0x1ba */ 0x4ac, 0x8ac, 0xc8c, 0xca4, 0xcac,
+    /* 0x1bc */ 0x52c, 0x92c, 0xd0c, 0xd24, 0xd2c,
+    /* 0x1cb */ 0x271,
+    /* 0x1d3 */ 0x4b1,
+    /* 0x1d6 */ 0x4b2,
+    /* 0x1d9 */ 0x274, 0x474, 0x664, 0x670, 0x674,
+    /* 0x1da */ 0x2b4, 0x4b4, 0x6a4, 0x6b0, 0x6b4,
+    /* 0x1e6 */ 0x932,
+    /* 0x1e9 */ 0xa70,
+    /* 0x1ec */ 0xb30,
+    /* 0x1f2 */ 0x4b8, 0x8b8, 0xc98, 0xcb0, 0xcb8,
+    /* 0x1f4 */ 0x538, 0x938, 0xd18, 0xd30, 0xd38,
+    /* 0x1f8 */ 0x23c, 0x43c, 0x62c, 0x638, 0x63c, 0x83c, 0xa1c, 0xa2c, 0xa34, 0xa38,
+                 0xc1c, 0xc34, 0xc3c, 0xe0c, 0xe18, 0xe1c, 0xe24, 0xe2c, 0xe30, 0xe34,
+                 0xe38,
+    /* 0x07f */ 0x24f, 0x28f, 0x2cb, 0x2ce, 0x2cf, 0x30f, 0x347, 0x34b, 0x34d, 0x34e,
+                 0x34f, 0x387, 0x38d, 0x38f, 0x3c3, 0x3c6, 0x3c7, 0x3c9, 0x3cb, 0x3cc,
+                 0x3cd, 0x3ce, 0x3cf,
+    /* 0x0bf */ 0x44f, 0x48f, 0x4cb, 0x4ce, 0x4cf, 0x50f, 0x547, 0x54b, 0x54d, 0x54e,
+                 0x54f, 0x587, 0x58d, 0x58f, 0x5c3, 0x5c6, 0x5c7, 0x5c9, 0x5cb, 0x5cc,
+                 0x5cd, 0x5ce, 0x5cf,
+    /* 0x0df */ 0x257, 0x297, 0x2d3, 0x2d6, 0x2d7, 0x457, 0x497, 0x4d3, 0x4d6, 0x4d7,
+                 0x647, 0x653, 0x657, 0x687, 0x693, 0x697, 0x6c3, 0x6c6, 0x6c7, 0x6d2,
+                 0x6d3, 0x6d6, 0x6d7,
+    /* 0x0ef */ 0x353,
+    /* 0x0f7 */ 0x49b, 0x51b, 0x593, 0x599, 0x59b,
+    /* 0x0fb */ 0x25d, 0x29d, 0x2d9, 0x2dc, 0x2dd, 0x45d, 0x49d, 0x4d9, 0x4dc, 0x4dd,
+                 0x64d, 0x659, 0x65d, 0x68d, 0x699, 0x69d, 0x6c9, 0x6cc, 0x6cd, 0x6d8,
+                 0x6d9, 0x6dc, 0x6dd,
+    /* 0x0fd */ 0x35c, 0x55c, 0x74c, 0x758, 0x75c,
+    /* 0x0fe */ 0x29e, 0x31e, 0x396, 0x39c, 0x39e, 0x49e, 0x51e, 0x596, 0x59c, 0x59e,
+                 0x68e, 0x69a, 0x69e, 0x70e, 0x71a, 0x71e, 0x786, 0x78c, 0x78e, 0x792,
+                 0x796, 0x798, 0x79a, 0x79c,
+    /* 0x13f */ 0x84f, 0x88f, 0x8cb, 0x8ce, 0x8cf, 0x90f, 0x947, 0x94b, 0x94d, 0x94e,
+                 0x94f, 0x987, 0x98d, 0x98f, 0x9c3, 0x9c6, 0x9c7, 0x9c9, 0x9cb, 0x9cc,
+                 0x9cd, 0x9ce, 0x9cf,
+    /* 0x16f */ 0xb43,
+    /* 0x17b */ 0xa4d, 0xa8d, 0xac9, 0xacc, 0xacd,
+    /* 0x17d */ 0xb4c,
+    /* 0x17e */ 0xa8e, 0xb0e, 0xb86, 0xb8c, 0xb8e,
+    /* 0x19f */ 0x467, 0x4a7, 0x4e3, 0x4e6, 0x4e7,
+    /* 0x1af */ 0x963,
+    /* 0x1b7 */ 0x4ab, 0x52b, 0x5a3, 0x5a9, 0x5ab, 0x8ab, 0x92b, 0x9a3, 0x9a9, 0x9ab,
+                 0xc8b, 0xca3, 0xcab, 0xd0b, 0xd23, 0xd2b, 0xd83, 0xd89, 0xd8b, 0xda1,
+                 0xda3, 0xda9, 0xdab,
+    /* 0x1bb */ 0x46d, 0x4ad, 0x4e9, 0x4ec, 0x4ed, 0x86d, 0x8ad, 0x8e9, 0x8ec, 0x8ed,
+                 0xc4d, 0xc65, 0xc6d, 0xc8d, 0xca5, 0xcad, 0xcc9, 0xccc, 0xccd, 0xce1,
+                 0xce4, 0xce5, 0xce9, 0xcec,
+    /* 0x1bd */ 0x56c, 0x96c, 0xd4c, 0xd64, 0xd6c,
+    /* 0x1be */ 0x4ae, 0x52e, 0x5a6, 0x5ac, 0x5ae, 0x8ae, 0x92e, 0x9a6, 0x9ac, 0x9ae,
+                 0xc8e, 0xca6, 0xcae, 0xd0e, 0xd26, 0xd2e, 0xd86, 0xd8c, 0xd8e, 0xda4,
+                 0xda6, 0xdac, 0xdae,
+    /* 0x1cf */ 0x273,
+    /* 0x1d7 */ 0x4b3,
+    /* 0x1db */ 0x275, 0x2b5, 0x2f1, 0x2f4, 0x2f5, 0x475, 0x4b5, 0x4f1, 0x4f4, 0x4f5,
+                 0x665, 0x671, 0x675, 0x6a5, 0x6b1, 0x6b5, 0x6e1, 0x6e4, 0x6e5, 0x6f0,
+                 0x6f1, 0x6f4, 0x6f5,
+    /* 0x1de */ 0x2b6, 0x4b6, 0x6a6, 0x6b2, 0x6b6,
+    /* 0x1e7 */ 0x933,
+    /* 0x1eb */ 0xa71,
+    /* 0x1ed */ 0xb70,
+    /* 0x1ee */ 0xb32,
+    /* 0x1f3 */ 0x4b9, 0x8b9, 0xc99, 0xcb1, 0xcb9,
+    /* 0x1f6 */ 0x4ba, 0x53a, 0x5b2, 0x5b8, 0x5ba, 0x8ba, 0x93a, 0x9b2, 0x9b8, 0x9ba,
+                 0xc9a, 0xcb2, 0xcba, 0xd1a, 0xd32, 0xd3a, 0xd92, 0xd98, 0xd9a, 0xdb0,
+                 0xdb2, 0xdb8, 0xdba,
+    /* 0x1f9 */ 0x27c, 0x47c, 0x66c, 0x678, 0x67c, 0x87c, 0xa5c, 0xa6c, 0xa74, 0xa78,
+                 0xa7c, 0xc5c, 0xc74, 0xc7c, 0xe4c, 0xe58, 0xe5c, 0xe64, 0xe6c, 0xe70,
+                 0xe74, 0xe78, 0xe7c,
+    /* 0x1fa */ 0x2bc, 0x4bc, 0x6ac, 0x6b8, 0x6bc, 0x8bc, 0xa9c, 0xaac, 0xab4, 0xab8,
+                 0xabc, 0xc9c, 0xcb4, 0xcbc, 0xe8c, 0xe98, 0xe9c, 0xea4, 0xeac, 0xeb0,
+                 0xeb4, 0xeb8, 0xebc,
+    /* 0x1fc */ 0x33c, 0x53c, 0x72c, 0x738, 0x73c, 0x93c, 0xb1c, 0xb2c, 0xb34, 0xb38,
+                 0xb3c, 0xd1c, 0xd34, 0xd3c, 0xf0c, 0xf18, 0xf1c, 0xf24, 0xf2c, 0xf30,
+                 0xf34, 0xf38, 0xf3c,
+    /* 0x0ff */ 0x25f, 0x29f, 0x2db, 0x2de, 0x2df, 0x31f, 0x357, 0x35b, 0x35d, 0x35e,
+                 0x35f, 0x397, 0x39d, 0x39f, 0x3d3, 0x3d6, 0x3d7, 0x3d9, 0x3db, 0x3dc,
+                 0x3dd, 0x3de, 0x3df, 0x45f, 0x49f, 0x4db, 0x4de, 0x4df, 0x51f, 0x557,
+                 0x55b, 0x55d, 0x55e, 0x55f, 0x597, 0x59d, 0x59f, 0x5d3, 0x5d6, 0x5d7,
+                 0x5d9, 0x5db, 0x5dc, 0x5dd, 0x5de, 0x5df, 0x64f, 0x65b, 0x65f, 0x68f,
+                 0x69b, 0x69f, 0x6cb, 0x6ce, 0x6cf, 0x6da, 0x6db, 0x6de, 0x6df, 0x70f,
+                 0x71b, 0x71f, 0x747, 0x74b, 0x74d, 0x74e, 0x74f, 0x753, 0x757, 0x759,
+                 0x75a, 0x75d, 0x75e, 0x787, 0x78d, 0x78f, 0x793, 0x797, 0x799, 0x79b,
+                 0x79d, 0x79f, 0x7c3, 0x7c6, 0x7c7, 0x7c9, 0x7cb, 0x7cc, 0x7cd, 0x7ce,
+                 0x7cf, 0x7d2, 0x7d3, 0x7d6, 0x7d7, 0x7d8, 0x7d9, 0x7da, 0x7dc, 0x7dd,
+                 0x7de,
+    /* 0x17f */ 0xa4f, 0xa8f, 0xacb, 0xace, 0xacf, 0xb0f, 0xb47, 0xb4b, 0xb4d, 0xb4e,
+                 0xb4f, 0xb87, 0xb8d, 0xb8f, 0xbc3, 0xbc6, 0xbc7, 0xbc9, 0xbcb, 0xbcc,
+                 0xbcd, 0xbce, 0xbcf,
+    /* 0x1bf */ 0x46f, 0x4af, 0x4eb, 0x4ee, 0x4ef, 0x52f, 0x567, 0x56b, 0x56d, 0x56e,
+                 0x56f, 0x5a7, 0x5ad, 0x5af, 0x5e3, 0x5e6, 0x5e7, 0x5e9, 0x5eb, 0x5ec,
+                 0x5ed, 0x5ee, 0x5ef, 0x86f, 0x8af, 0x8eb, 0x8ee, 0x8ef, 0x92f, 0x967,
+                 0x96b, 0x96d, 0x96e, 0x96f, 0x9a7, 0x9ad, 0x9af, 0x9e3, 0x9e6, 0x9e7,
+                 0x9e9, 0x9eb, 0x9ec, 0x9ed, 0x9ee, 0x9ef, 0xc4f, 0xc67, 0xc6f, 0xc8f,
+                 0xca7, 0xcaf, 0xccb, 0xcce, 0xccf, 0xce3, 0xce6, 0xce7, 0xceb, 0xcee,
+                 0xcef, 0xd0f, 0xd27, 0xd2f, 0xd47, 0xd4b, 0xd4d, 0xd4e, 0xd4f, 0xd63,
+                 0xd65, 0xd66, 0xd6b, 0xd6d, 0xd6e, 0xd87, 0xd8d, 0xd8f, 0xda5, 0xda7,
+                 0xdad, 0xdaf, 0xdc3, 0xdc6, 0xdc7, 0xdc9, 0xdcb, 0xdcc, 0xdcd, 0xdce,
+                 0xdcf, 0xde1, 0xde3, 0xde4, 0xde5, 0xde6, 0xde9, 0xdeb, 0xdec, 0xded,
+                 0xdee,
+    /* 0x1df */ 0x277, 0x2b7, 0x2f3, 0x2f6, 0x2f7, 0x477, 0x4b7, 0x4f3, 0x4f6, 0x4f7,
+                 0x667, 0x673, 0x677, 0x6a7, 0x6b3, 0x6b7, 0x6e3, 0x6e6, 0x6e7, 0x6f2,
+                 0x6f3, 0x6f6, 0x6f7,
+    /* 0x1ef */ 0x373, 0x973, 0xa73, 0xb33, 0xb53, 0xb63, 0xb71, 0xb72,
+    /* 0x1f7 */ 0x4bb, 0x53b, 0x5b3, 0x5b9, 0x5bb, 0x8bb, 0x93b, 0x9b3, 0x9b9, 0x9bb,
+                 0xc9b, 0xcb3, 0xcbb, 0xd1b, 0xd33, 0xd3b, 0xd93, 0xd99, 0xd9b, 0xdb1,
+                 0xdb3, 0xdb9, 0xdbb,
+    /* 0x1fb */ 0x27d, 0x2bd, 0x2f9, 0x2fc, 0x2fd, 0x47d, 0x4bd, 0x4f9, 0x4fc, 0x4fd,
+                 0x66d, 0x679, 0x67d, 0x6ad, 0x6b9, 0x6bd, 0x6e9, 0x6ec, 0x6ed, 0x6f8,
+                 0x6f9, 0x6fc, 0x6fd, 0x87d, 0x8bd, 0x8f9, 0x8fc, 0x8fd, 0xa5d, 0xa6d,
+                 0xa75, 0xa79, 0xa7d, 0xa9d, 0xaad, 0xab5, 0xab9, 0xabd, 0xad9, 0xadc,
+                 0xadd, 0xae9, 0xaec, 0xaed, 0xaf1, 0xaf4, 0xaf5, 0xaf8, 0xafc, 0xc5d,
+                 0xc75, 0xc7d, 0xc9d, 0xcb5, 0xcbd, 0xcd9, 0xcdc, 0xcdd, 0xcf1, 0xcf4,
+                 0xcf5, 0xcf9, 0xcfc, 0xcfd, 0xe4d, 0xe59, 0xe5d, 0xe65, 0xe6d, 0xe71,
+                 0xe75, 0xe79, 0xe7d, 0xe8d, 0xe99, 0xe9d, 0xea5, 0xead, 0xeb1, 0xeb5,
+                 0xeb9, 0xebd, 0xec9, 0xecc, 0xecd, 0xed8, 0xed9, 0xedc, 0xedd, 0xee1,
+                 0xee4, 0xee5, 0xee9, 0xeec, 0xeed, 0xef0, 0xef1, 0xef4, 0xef5, 0xef8,
+                 0xefc,
+    /* 0x1fd */ 0x37c, 0x57c, 0x76c, 0x778, 0x77c, 0x97c, 0xb5c, 0xb6c, 0xb74, 0xb78,
+                 0xb7c, 0xd5c, 0xd74, 0xd7c, 0xf4c, 0xf58, 0xf5c, 0xf64, 0xf6c, 0xf70,
+                 0xf74, 0xf78, 0xf7c,
+    /* 0x1fe */ 0x2be, 0x33e, 0x3b6, 0x3bc, 0x3be, 0x4be, 0x53e, 0x5b6, 0x5bc, 0x5be,
+                 0x6ae, 0x6ba, 0x6be, 0x72e, 0x73a, 0x73e, 0x7a6, 0x7ac, 0x7ae, 0x7b2,
+                 0x7b6, 0x7b8, 0x7ba, 0x7bc, 0x7be, 0x8be, 0x93e, 0x9b6, 0x9bc, 0x9be,
+                 0xa9e, 0xaae, 0xab6, 0xaba, 0xabe, 0xb1e, 0xb2e, 0xb36, 0xb3a, 0xb3e,
+                 0xb96, 0xb9c, 0xb9e, 0xba6, 0xbac, 0xbae, 0xbb2, 0xbb4, 0xbb8, 0xbba,
+                 0xbbc, 0xc9e, 0xcb6, 0xcbe, 0xd1e, 0xd36, 0xd3e, 0xd96, 0xd9c, 0xd9e,
+                 0xdb4, 0xdb6, 0xdbc, 0xdbe, 0xe8e, 0xe9a, 0xe9e, 0xea6, 0xeae, 0xeb2,
+                 0xeb6, 0xeba, 0xebe, 0xf0e, 0xf1a, 0xf1e, 0xf26, 0xf2e, 0xf32, 0xf36,
+                 0xf3a, 0xf3e, 0xf86, 0xf8c, 0xf8e, 0xf92, 0xf96, 0xf98, 0xf9a, 0xf9c,
+                 0xf9e, 0xfa4, 0xfa6, 0xfac, 0xfae, 0xfb0, 0xfb2, 0xfb4, 0xfb8, 0xfba,
+                 0xfbc,
+    /* 0x1ff */ 0x27f, 0x2bf, 0x2fb, 0x2fe, 0x2ff, 0x33f, 0x377, 0x37b, 0x37d, 0x37e,
+                 0x37f, 0x3b7, 0x3bd, 0x3bf, 0x3f3, 0x3f6, 0x3f7, 0x3f9, 0x3fb, 0x3fc,
+                 0x3fd, 0x3fe, 0x3ff, 0x47f, 0x4bf, 0x4fb, 0x4fe, 0x4ff, 0x53f, 0x577,
+                 0x57b, 0x57d, 0x57e, 0x57f, 0x5b7, 0x5bd, 0x5bf, 0x5f3, 0x5f6, 0x5f7,
+                 0x5f9, 0x5fb, 0x5fc, 0x5fd, 0x5fe, 0x5ff, 0x66f, 0x67b, 0x67f, 0x6af,
+                 0x6bb, 0x6bf, 0x6eb, 0x6ee, 0x6ef, 0x6fa, 0x6fb, 0x6fe, 0x6ff, 0x72f,
+                 0x73b, 0x73f, 0x767, 0x76b, 0x76d, 0x76e, 0x76f, 0x773, 0x777, 0x779,
+                 0x77a, 0x77b, 0x77d, 0x77e, 0x77f, 0x7a7, 0x7ad, 0x7af, 0x7b3, 0x7b7,
+                 0x7b9, 0x7bb, 0x7bd, 0x7bf, 0x7e3, 0x7e6, 0x7e7, 0x7e9, 0x7eb, 0x7ec,
+                 0x7ed, 0x7ee, 0x7ef, 0x7f2, 0x7f3, 0x7f6, 0x7f7, 0x7f8, 0x7f9, 0x7fa,
+                 0x7fb, 0x7fc, 0x7fd, 0x7fe, 0x7ff, 0x87f, 0x8bf, 0x8fb, 0x8fe, 0x8ff,
+                 0x93f, 0x977, 0x97b, 0x97d, 0x97e, 0x97f, 0x9b7, 0x9bd, 0x9bf, 0x9f3,
+                 0x9f6, 0x9f7, 0x9f9, 0x9fb, 0x9fc, 0x9fd, 0x9fe, 0x9ff, 0xa5f, 0xa6f,
+                 0xa77, 0xa7b, 0xa7f, 0xa9f, 0xaaf, 0xab7, 0xabb, 0xabf, 0xadb, 0xade,
+                 0xadf, 0xaeb, 0xaee, 0xaef, 0xaf3, 0xaf6, 0xaf7, 0xafa, 0xafb, 0xafe,
+                 0xaff, 0xb1f, 0xb2f, 0xb37, 0xb3b, 0xb3f, 0xb57, 0xb5b, 0xb5d, 0xb5e,
+                 0xb5f, 0xb67, 0xb6b, 0xb6d, 0xb6e, 0xb6f, 0xb75, 0xb76, 0xb77, 0xb79,
+                 0xb7a, 0xb7b, 0xb7d, 0xb7e, 0xb97, 0xb9d, 0xb9f, 0xba7, 0xbad, 0xbaf,
+                 0xbb3, 0xbb5, 0xbb7, 0xbb9, 0xbbb, 0xbbd, 0xbbf, 0xbd3, 0xbd6, 0xbd7,
+                 0xbd9, 0xbdb, 0xbdc, 0xbdd, 0xbde, 0xbdf, 0xbe3, 0xbe6, 0xbe7, 0xbe9,
+                 0xbeb, 0xbec, 0xbed, 0xbee, 0xbef, 0xbf1, 0xbf2, 0xbf3, 0xbf4, 0xbf5,
+                 0xbf6, 0xbf8, 0xbf9, 0xbfa, 0xbfc, 0xbfd, 0xbfe, 0xc5f, 0xc77, 0xc7f,
+                 0xc9f, 0xcb7, 0xcbf, 0xcdb, 0xcde, 0xcdf, 0xcf3, 0xcf6, 0xcf7, 0xcfb,
+                 0xcfe, 0xcff, 0xd1f, 0xd37, 0xd3f, 0xd57, 0xd5b, 0xd5d, 0xd5e, 0xd5f,
+                 0xd73, 0xd75, 0xd76, 0xd77, 0xd7b, 0xd7d, 0xd7e, 0xd7f, 0xd97, 0xd9d,
+                 0xd9f, 0xdb5, 0xdb7, 0xdbd, 0xdbf, 0xdd3, 0xdd6, 0xdd7, 0xdd9, 0xddb,
+                 0xddc, 0xddd, 0xdde, 0xddf, 0xdf1, 0xdf3, 0xdf4, 0xdf5, 0xdf6, 0xdf7,
+                 0xdf9, 0xdfb, 0xdfc, 0xdfd, 0xdfe, 0xdff, 0xe4f, 0xe5b, 0xe5f, 0xe67,
+                 0xe6f, 0xe73, 0xe77, 0xe7b, 0xe7f, 0xe8f, 0xe9b, 0xe9f, 0xea7, 0xeaf,
+                 0xeb3, 0xeb7, 0xebb, 0xebf, 0xecb, 0xece, 0xecf, 0xeda, 0xedb, 0xede,
+                 0xedf, 0xee3, 0xee6, 0xee7, 0xeeb, 0xeee, 0xeef, 0xef2, 0xef3, 0xef6,
+                 0xef7, 0xefa, 0xefb, 0xefe, 0xeff, 0xf0f, 0xf1b, 0xf1f, 0xf27, 0xf2f,
+                 0xf33, 0xf37, 0xf3b, 0xf3f, 0xf47, 0xf4b, 0xf4d, 0xf4e, 0xf4f, 0xf53,
+                 0xf57, 0xf59, 0xf5a, 0xf5b, 0xf5d, 0xf5e, 0xf5f, 0xf63, 0xf65, 0xf66,
+                 0xf67, 0xf6b, 0xf6d, 0xf6e, 0xf6f, 0xf71, 0xf72, 0xf73, 0xf75, 0xf76,
+                 0xf79, 0xf7a, 0xf7d, 0xf7e, 0xf87, 0xf8d, 0xf8f, 0xf93, 0xf97, 0xf99,
+                 0xf9b, 0xf9d, 0xf9f, 0xfa5, 0xfa7, 0xfad, 0xfaf, 0xfb1, 0xfb3, 0xfb5,
+                 0xfb7, 0xfb9, 0xfbb, 0xfbd, 0xfbf, 0xfc3, 0xfc6, 0xfc7, 0xfc9, 0xfcb,
+                 0xfcc, 0xfcd, 0xfce, 0xfcf, 0xfd2, 0xfd3, 0xfd6, 0xfd7, 0xfd8, 0xfd9,
+                 0xfda, 0xfdb, 0xfdc, 0xfdd, 0xfde, 0xfdf, 0xfe1, 0xfe3, 0xfe4, 0xfe5,
+                 0xfe6, 0xfe7, 0xfe9, 0xfeb, 0xfec, 0xfed, 0xfee, 0xfef, 0xff0, 0xff1,
+                 0xff2, 0xff4, 0xff5, 0xff6, 0xff8, 0xff9, 0xffa, 0xffc, 0xffd, 0xffe,
+};
 
-    while (!isFullyTransitive(numRooms, connections)) {
+// Index of the first corridor set of layout i in corridorSets, for i = 0..139
+const short corridorSetsStart[] = {
+    0, 5, 6, 11, 16, 17, 22, 23, 28, 29, 30, 31,
+    32, 33, 38, 39, 40, 45, 46, 47, 48, 49, 50, 51,
+    56, 61, 62, 63, 68, 69, 70, 75, 76, 77, 78, 79,
+    80, 81, 82, 83, 84, 89, 94, 99, 100, 101, 106, 107,
+    108, 113, 134, 139, 140, 145, 146, 151, 156, 161, 166, 167,
+    172, 173, 174, 195, 200, 201, 206, 211, 216, 221, 222, 227,
+    232, 233, 238, 239, 240, 241, 242, 247, 248, 249, 254, 275,
+    280, 285, 290, 291, 292, 293, 298, 303, 304, 305, 306, 311,
+    316, 337, 360, 383, 406, 407, 412, 435, 440, 464, 487, 488,
+    493, 494, 499, 504, 505, 528, 552, 557, 580, 581, 582, 605,
+    610, 611, 612, 613, 614, 619, 642, 665, 688, 711, 812, 835,
+    936, 959, 967, 990, 1091, 1114, 1215, 1635,
+};
 
-        // pick two random rooms
-        int room1Index = rand() % numRooms;
-        int room2Index = (room1Index + 1 + rand() % (numRooms - 1)) % numRooms;
-        int room1Quad = rooms[room1Index].wallChar - '0';
-        int room2Quad = rooms[room2Index].wallChar - '0';
+// One in LOOP_CORRIDOR_ODDS of the corridors a spanning tree doesn't need are
+// kept anyway, so large grids get some loops like the 3x3 corridor sets do
+#define LOOP_CORRIDOR_ODDS 4
 
-        // printf("Attempting to connect quads %d and %d\n", room1Quad, room2Quad);
+/**
+ * Draws a random connected set of corridors on a grid of any size.
+ *
+ * Shuffles every pair of cardinally adjacent rooms and keeps each pair that joins
+ * two groups of rooms not yet connected (a random spanning tree), plus the odd
+ * pair that closes a loop.
+ *
+ * @param gen The generator whose grid and corridor stream to use.
+ * @param rooms The rooms placed.
+ * @param edges Filled in with the cells at both ends of each corridor, two per corridor,
+ *              needs room for 4 * numRooms.
+ * @return The number of corridors drawn, -1 if memory could not be allocated.
+ */
+int spanningCorridors(struct Generator *gen, const struct RoomTable *rooms, int *edges) {
+    int gridCols = gen->gridCols;
+    int cells = gridCols * gen->gridRows;
+    int count = 0;
 
-        /// TODO: rewrite this logic so that it is more readable
-        // check to make sure that the rooms are in valid quadrants
-        if(room1Quad < 0 || room1Quad > 8 || room2Quad < 0 || room2Quad > 8 || room1Quad == room2Quad) {
-            printf("Error: rooms %d (quad %d) or %d (quad %d) have invalid quads\n", room1Index, room1Quad, room2Index, room2Quad);
-            // printf("Room index %d has a quad of %d\n", room1Index, room1Quad);
-            // printf("Room index %d has a quad of %d\n", room2Index, room2Quad);
+    // every room only pairs with the rooms east and south of it, so each pair is listed once
+    for (int cell = 0; cell < cells; cell++) {
+        if (rooms->roomOfQuadrant[cell] == -1) {
             continue;
         }
+        if ((cell + 1) % gridCols != 0 && rooms->roomOfQuadrant[cell + 1] != -1) {
+            edges[2 * count] = cell;
+            edges[2 * count + 1] = cell + 1;
+            count++;
+        }
+        if (cell + gridCols < cells && rooms->roomOfQuadrant[cell + gridCols] != -1) {
+            edges[2 * count] = cell;
+            edges[2 * count + 1] = cell + gridCols;
+            count++;
+        }
+    }
 
+    // Fisher-Yates shuffle of the pairs
+    for (int i = count - 1; i > 0; i--) {
+        int j = rngRange(&gen->corridorsRng, i + 1);
+        int a = edges[2 * i], b = edges[2 * i + 1];
+        edges[2 * i] = edges[2 * j];
+        edges[2 * i + 1] = edges[2 * j + 1];
+        edges[2 * j] = a;
+        edges[2 * j + 1] = b;
+    }
 
-        /// TODO: see if we can remove this next check if we can determine it is redundant/unnecessary
-        if(!roomExists(room1Quad) || !roomExists(room2Quad)) {
-            printf("Error: rooms %d (quad %d) or %d (quad %d) do not exist\n", room1Index, room1Quad, room2Index, room2Quad);
-            // printf("Room index %d has a quad of %d\n", room1Index, room1Quad);
-            // printf("Room index %d has a quad of %d\n", room2Index, room2Quad);
-            continue;
-        } else {
-            // printf("Rooms %d and %d exist\n", room1Index, room2Index);
-            // printf("Room index %d has a quad of %d\n", room1Index, room1Quad);
-            // printf("Room index %d has a quad of %d\n", room2Index, room2Quad);
-        }
-
-        // room1 and room2 are not already connected and their quads are adjacet
-        // we can place a corridor between them
-        if (!connections[room1Index][room2Index] && areAdjacentSimple(room1Quad, room2Quad) != -1) {
-
-            // debug 1
-            // printf("Attempting to place a corridor between rooms %d and %d in quads %d and %d\n", room1Index, room2Index, room1Quad, room2Quad);   
-            calculateNeighborsSimple(room1Quad);
-            int wall1 = getFacingWallDirectionSimple(room1Quad, room2Quad);
-            clearNeighborsSimple(neighborsSimple);
-
-            calculateNeighborsSimple(room2Quad);
-            int wall2 = getFacingWallDirectionSimple(room2Quad, room1Quad);
-            clearNeighborsSimple(neighborsSimple);
-            // debug 3
-            // printf("The wall directions are %d and %d to connect quads %d and %d\n", wall1, wall2, room1Quad, room2Quad);
-
-            // this prevents making a connection when wall directions are invalid or the walls have already been used
-            if(wall1 > 3 || wall2 > 3 || wallsUsed[room1Index][wall1] || wallsUsed[room2Index][wall2]) {
-                // printf("Error: wall %d of quad %d OR wall %d of quad %d are already used or invalid wall direction value\n", wall1, room1Quad, wall2, room2Quad);
-                continue;
-            } else {
-                firstWallPoint = getRandomPointOnWall(rooms[room1Index], wall1);
-                secondWallPoint = getRandomPointOnWall(rooms[room2Index], wall2);
-                wallsUsed[room1Index][wall1] = 1;
-                wallsUsed[room2Index][wall2] = 1;
-
-                int x = firstWallPoint->x;
-                int y = firstWallPoint->y;
-                int target_x = secondWallPoint->x;
-                int target_y = secondWallPoint->y;
-
-                // debug 4
-                // printf("... marking from point (%d, %d) to point (%d, %d) for path number %c\n", x, y, target_x, target_y, pathLetter);
-                // printf("\n");
-
-                int stepCounter = 0;
-                // Perform random walk from the 1st point to the 2nd point
-                while (x != target_x || y != target_y) {
-                    int moveInXDirection = (x != target_x) && ((y == target_y) || (rand() % 2));
-                    int moveInYDirection = (y != target_y) && ((x == target_x) || (rand() % 2));
-
-                    // For the first two steps, move in the direction away from the wall
-                    if (stepCounter < 2) {
-                        // For the first two steps and last two steps, move in the direction away from the wall
-                        if (wall1 == 0 || wall1 == 2) { // If the wall is on the north or south
-                            moveInYDirection = 1;
-                            moveInXDirection = 0;
-                        } else { // If the wall is on the east or west
-                            moveInXDirection = 1;
-                            moveInYDirection = 0;
-                        }
-                    }
+    struct UnionFind tree;
+    if (!initUnionFind(&tree, rooms->count)) {
+        return -1;
+    }
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        int a = edges[2 * i], b = edges[2 * i + 1];
+        if (unionSets(&tree, rooms->roomOfQuadrant[a], rooms->roomOfQuadrant[b]) ||
+            rngRange(&gen->corridorsRng, LOOP_CORRIDOR_ODDS) == 0) {
+            edges[2 * kept] = a;
+            edges[2 * kept + 1] = b;
+            kept++;
+        }
+    }
+    freeUnionFind(&tree);
+    return kept;
+}
 
-                    if (moveInXDirection) {
-                        int step_x = (x > target_x) ? -1 : 1;
-                        if(x == target_x) {
-                            step_x = 0;
-                        }
-                        x += step_x;
-                    }
-                    else if (moveInYDirection) {
-                        int step_y = (y > target_y) ? -1 : 1;
-                        if(y == target_y) {
-                            step_y = 0;
-                        }
-                        y += step_y;
-                    }
+// Starting capacity of a level's corridor run pool, per corridor; the pool doubles if a level needs more
+#define CORRIDOR_RUNS_PER_CORRIDOR 16
+
+/**
+ * Extends the last run in a corridor run pool by one step, or starts a new run.
+ *
+ * @param runs The pool, grown when it is full.
+ * @param numRuns The number of runs in the pool.
+ * @param capacity The number of runs the pool has room for.
+ * @param firstRun The index of the current corridor's first run, so runs of
+ *                 neighbouring corridors are never merged.
+ * @param direction The wall direction of the step.
+ * @return 1 on success, 0 if the pool could not be grown.
+ */
+int appendCorridorStep(struct CorridorRun **runs, int *numRuns, int *capacity, int firstRun, int direction) {
+    struct CorridorRun *last = *numRuns > firstRun ? &(*runs)[*numRuns - 1] : NULL;
+    if (last && last->direction == direction && last->length < UINT8_MAX) {
+        last->length++;
+        return 1;
+    }
+    if (*numRuns == *capacity) {
+        struct CorridorRun *grown = realloc(*runs, 2 * *capacity * sizeof(struct CorridorRun));
+        if (grown == NULL) {
+            return 0;
+        }
+        *runs = grown;
+        *capacity *= 2;
+    }
+    (*runs)[(*numRuns)++] = (struct CorridorRun) {direction, 1};
+    return 1;
+}
+
+/**
+ * Places corridors between rooms in the given map.
+ *
+ * The whole corridor graph is drawn at once, from corridorSets for the layout
+ * placeRooms picked on a 3x3 grid or from spanningCorridors on any other grid,
+ * so all that is left to do is carve each corridor.
+ *
+ * @param gen The generator whose random state and room layout to use.
+ * @param map The game map.
+ * @param rooms The rooms placed.
+ * @param corridorEnds Filled in with both ends of every corridor placed, needs room for 4 * numRooms.
+ * @param numCorridors Set to the number of corridors placed.
+ * @param runs Set to the pool holding the runs of every corridor, freed by the caller.
+ * @param numRuns Set to the number of runs in the pool.
+ * @return The corridors placed as polylines over the run pool, NULL if memory could not be allocated.
+ */
+struct Corridor *placeCorridors(struct Generator *gen, struct TileMap *map, const struct RoomTable *rooms,
+                                struct CorridorEnd *corridorEnds, int *numCorridors,
+                                struct CorridorRun **runs, int *numRuns) {
+    int numRooms = rooms->count;
+    int placed = 0;
+    int pathTile = TILE_CORRIDOR;
+
+    // track which rooms are connected as each corridor is carved
+    struct UnionFind connected;
+    if (!initUnionFind(&connected, numRooms)) {
+        return NULL;
+    }
+
+    // the cells at both ends of each corridor to carve
+    int *edges = gen->cellScratch;
+    int numEdges = 0;
+    if (gen->layoutIndex >= 0) {
+        int first = corridorSetsStart[gen->layoutIndex];
+        int count = corridorSetsStart[gen->layoutIndex + 1] - first;
+        int corridorSet = corridorSets[first + rngRange(&gen->corridorsRng, count)];
+        for (int edge = 0; edge < 12; edge++) {
+            if (corridorSet & (1 << edge)) {
+                edges[2 * numEdges] = corridorEdges[edge][0];
+                edges[2 * numEdges + 1] = corridorEdges[edge][1];
+                numEdges++;
+            }
+        }
+    } else {
+        numEdges = spanningCorridors(gen, rooms, edges);
+        if (numEdges < 0) {
+            freeUnionFind(&connected);
+            return NULL;
+        }
+    }
 
-                    matrix[y][x] = pathLetter; // Mark the corridor path
-                    stepCounter++;
+    // every edge becomes exactly one corridor
+    struct Corridor *corridors = malloc(numEdges * sizeof(struct Corridor));
+    int runCapacity = CORRIDOR_RUNS_PER_CORRIDOR * (numEdges > 0 ? numEdges : 1);
+    *runs = malloc(runCapacity * sizeof(struct CorridorRun));
+    *numRuns = 0;
+    int ok = corridors != NULL && *runs != NULL; // 0 once an allocation fails
+
+    for (int edge = 0; edge < numEdges && ok; edge++) {
+        // carve from either end, so corridors don't always leave by the east or south wall
+        int flip = rngRange(&gen->corridorsRng, 2);
+        int room1Quad = edges[2 * edge + flip];
+        int room2Quad = edges[2 * edge + 1 - flip];
+        int room1Index = rooms->roomOfQuadrant[room1Quad];
+        int room2Index = rooms->roomOfQuadrant[room2Quad];
+        int wall1 = cellFacingWall(gen->gridCols, room1Quad, room2Quad);
+        int wall2 = (wall1 + 2) % 4; // the facing wall of the other room is always the opposite one
+
+        // debug 1
+        // printf("Placing a corridor between rooms %d and %d in quads %d and %d\n", room1Index, room2Index, room1Quad, room2Quad);
+        gen->firstWallPoint = getRandomPointOnWall(gen, roomRect(rooms, room1Index), wall1);
+        gen->secondWallPoint = getRandomPointOnWall(gen, roomRect(rooms, room2Index), wall2);
+
+        int x = gen->firstWallPoint.x;
+        int y = gen->firstWallPoint.y;
+        int target_x = gen->secondWallPoint.x;
+        int target_y = gen->secondWallPoint.y;
+
+        corridors[placed] = (struct Corridor) {gen->firstWallPoint, *numRuns, 0, {room1Index, room2Index}};
+        int stepCounter = 0;
+        // Perform random walk from the 1st point to the 2nd point
+        while ((x != target_x || y != target_y) && ok) {
+            int moveInXDirection = (x != target_x) && ((y == target_y) || rngRange(&gen->corridorsRng, 2));
+            int moveInYDirection = (y != target_y) && ((x == target_x) || rngRange(&gen->corridorsRng, 2));
+            int direction = -1; // of the step taken, if any
+
+            // For the first two steps, move in the direction away from the wall
+            if (stepCounter < 2) {
+                // For the first two steps and last two steps, move in the direction away from the wall
+                if (wall1 == 0 || wall1 == 2) { // If the wall is on the north or south
+                    moveInYDirection = 1;
+                    moveInXDirection = 0;
+                } else { // If the wall is on the east or west
+                    moveInXDirection = 1;
+                    moveInYDirection = 0;
                 }
+            }
+
+            if (moveInXDirection) {
+                int step_x = (x > target_x) ? -1 : 1;
+                if(x == target_x) {
+                    step_x = 0;
+                }
+                x += step_x;
+                direction = step_x > 0 ? 1 : step_x < 0 ? 3 : -1;
+            }
+            else if (moveInYDirection) {
+                int step_y = (y > target_y) ? -1 : 1;
+                if(y == target_y) {
+                    step_y = 0;
+                }
+                y += step_y;
+                direction = step_y > 0 ? 2 : step_y < 0 ? 0 : -1;
+            }
 
-                // we mark the start and end of the corridor with a different 
-                // character so we can come back later and place doors
-                matrix[firstWallPoint->y][firstWallPoint->x] = '?'; // temporarily mark the start of the corridor
-                matrix[target_y][target_x] = '?'; // temporarily mark the end of the corridor
-                // if(pathLetter == '4') {
-                //     printf("Storing the endpoint of the corridor at (%d, %d)\n", secondWallPoint->x, secondWallPoint->y);
-                //     printf("!!!\n");
-                // }
-
-                corridors[placed].xPos = x; // Store endpoint for simplicity
-                corridors[placed].yPos = y;
-                connections[room1Index][room2Index] = 1;
-                connections[room2Index][room1Index] = 1;
-                placed++;
+            ok = setTile(map, x, y, pathTile); // Mark the corridor path
+            stepCounter++;
+            // a step can stand still, which leaves no run
+            if (ok && direction >= 0) {
+                ok = appendCorridorStep(runs, numRuns, &runCapacity, corridors[placed].firstRun, direction);
             }
         }
+
+        // the walk never steps onto its own starting tile
+        ok = ok && setTile(map, gen->firstWallPoint.x, gen->firstWallPoint.y, pathTile);
+
+        // record both ends so placeDoors can go straight to them
+        corridorEnds[2 * placed] = (struct CorridorEnd) {gen->firstWallPoint, room1Index, wall1};
+        corridorEnds[2 * placed + 1] = (struct CorridorEnd) {gen->secondWallPoint, room2Index, wall2};
+
+        corridors[placed].runCount = *numRuns - corridors[placed].firstRun;
+        unionSets(&connected, room1Index, room2Index);
+        placed++;
     }
-    // debugging
-    // printWallsUsed(rooms, numRooms);
+
+    freeUnionFind(&connected);
+    if (!ok) {
+        free(corridors);
+        free(*runs);
+        *runs = NULL;
+        return NULL;
+    }
+    if (connected.components != 1) {
+        printf("Error: corridors left the rooms in %d separate groups\n", connected.components);
+    }
+    *numCorridors = placed;
 
     // debugging
     // printf("=========\n");
     // printf("after connecting the corridors the connections are:\n");
-    // printConnections(numRooms, connections); // numRooms
+    // printConnections(&graph); // once generateLevel has built it
     // printf("=========\n");
 
     return corridors;
 }
 
-// used to find door locations
-int isQuestionMark(char c) {
-    if (c == '?') {
-        return 1;
+/**
+ * Lists the tiles of a corridor in the order it was carved, from its start to its end.
+ *
+ * @param level The level the corridor belongs to.
+ * @param corridor The corridor's index.
+ * @param tiles Filled in with up to capacity tiles, may be NULL to only count them.
+ * @param capacity The number of tiles there is room for.
+ * @return The number of tiles in the corridor, which may be more than capacity.
+ */
+int corridorTiles(const struct Level *level, int corridor, struct Point *tiles, int capacity) {
+    const struct Corridor *c = &level->corridors[corridor];
+    struct Point point = c->start;
+    int count = 0;
+    if (count < capacity) {
+        tiles[count] = point;
     }
-    return 0;
+    count++;
+    for (int r = c->firstRun; r < c->firstRun + c->runCount; r++) {
+        struct CorridorRun run = level->corridorRuns[r];
+        for (int i = 0; i < run.length; i++) {
+            point.x += wallStepX[run.direction];
+            point.y += wallStepY[run.direction];
+            if (count < capacity) {
+                tiles[count] = point;
+            }
+            count++;
+        }
+    }
+    return count;
 }
 
-// used to find door locations
-int isWallOrPeriod(char c) {
-    if (c == '|' || c == '-' || c == '.') {
-        return 1;
+/**
+ * Places a door where each corridor meets a room's wall.
+ *
+ * Only the corridor ends recorded by placeCorridors are visited, so the cost
+ * grows with the number of corridors rather than with the size of the map.
+ *
+ * @param map The game map.
+ * @param corridorEnds Both ends of every corridor, as filled in by placeCorridors.
+ * @param numEnds The number of corridor ends.
+ * @return An array of numEnds door locations, door i belonging to corridorEnds[i],
+ *         NULL if memory could not be allocated.
+ */
+struct Point *placeDoors(struct TileMap *map, struct CorridorEnd *corridorEnds, int numEnds) {
+    struct Point *doors = malloc(numEnds * sizeof(struct Point));
+    if (doors == NULL) {
+        return NULL;
     }
-    return 0;
+    for (int i = 0; i < numEnds; i++) {
+        struct CorridorEnd end = corridorEnds[i];
+        // a corridor end lies just past its room's wall, so step back towards the room
+        doors[i].x = end.point.x - wallStepX[end.wall];
+        doors[i].y = end.point.y - wallStepY[end.wall];
+        if (!setTile(map, doors[i].x, doors[i].y, TILE_DOOR)) {
+            free(doors);
+            return NULL;
+        }
+    }
+    return doors;
 }
 
-// used to find door locations
-int isQorPeriod(char c) {
-    if (c == '.' || c == '?') {
-        return 1;
+
+#ifdef BENCHMARK
+/*
+Bit-plane view of the map, used by the benchmark's level audit. Each tile class
+gets its own bitset with one bit per tile (bit x % 64 of word x / 64 of a row),
+so a question about a tile's neighbourhood becomes a handful of shifts, ANDs and
+ORs over 64 tiles at a time instead of a chain of char comparisons per tile.
+Every plane is padded with a blank row above and below the map and a blank word
+either side of each row, so reading a neighbour never needs a bounds check and
+the row loops are plain 64-bit word operations the compiler is free to vectorize.
+*/
+enum TileClass {
+    TILE_CLASS_WALL, // TILE_WALL_HORIZONTAL and TILE_WALL_VERTICAL
+    TILE_CLASS_FLOOR,
+    TILE_CLASS_CORRIDOR,
+    TILE_CLASS_DOOR,
+    TILE_CLASS_PASSABLE, // floor, corridor or door
+    TILE_CLASS_COUNT
+};
+
+struct TilePlanes {
+    int rows;
+    int cols;
+    int wordsPerRow; // words holding a row's tiles
+    int stride; // words per row including the padding, wordsPerRow + 2
+    size_t planeWords; // words per plane including the padding rows, (rows + 2) * stride
+    uint64_t lastWordMask; // the bits of a row's last word that are real tiles
+    uint64_t *words; // TILE_CLASS_COUNT planes of planeWords words each
+};
+
+/**
+ * Allocates empty bit-planes for a map.
+ *
+ * @param planes The planes to initialize, release them with freeTilePlanes.
+ * @param rows The number of rows in the map.
+ * @param cols The number of columns in the map.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int initTilePlanes(struct TilePlanes *planes, int rows, int cols) {
+    planes->rows = rows;
+    planes->cols = cols;
+    planes->wordsPerRow = (cols + 63) / 64;
+    planes->stride = planes->wordsPerRow + 2;
+    planes->planeWords = (size_t)(rows + 2) * planes->stride;
+    planes->lastWordMask = (cols % 64) ? ((uint64_t)1 << (cols % 64)) - 1 : ~(uint64_t)0;
+    planes->words = calloc(TILE_CLASS_COUNT * planes->planeWords, sizeof(uint64_t));
+    return planes->words != NULL;
+}
+
+void freeTilePlanes(struct TilePlanes *planes) {
+    free(planes->words);
+    planes->words = NULL;
+}
+
+// Returns the bitset of one tile class
+uint64_t *tilePlane(struct TilePlanes *planes, enum TileClass tileClass) {
+    return planes->words + tileClass * planes->planeWords;
+}
+
+// Returns the word of a plane holding tiles 64 * word to 64 * word + 63 of row y
+uint64_t *planeWord(const struct TilePlanes *planes, uint64_t *plane, int y, int word) {
+    return plane + (size_t)(y + 1) * planes->stride + word + 1;
+}
+
+/**
+ * Fills the bit-planes from the map.
+ *
+ * @param planes The planes to fill, sized for the map by initTilePlanes.
+ * @param map The game map.
+ */
+void buildTilePlanes(struct TilePlanes *planes, const struct TileMap *map) {
+    uint64_t *wall = tilePlane(planes, TILE_CLASS_WALL);
+    uint64_t *floor = tilePlane(planes, TILE_CLASS_FLOOR);
+    uint64_t *corridor = tilePlane(planes, TILE_CLASS_CORRIDOR);
+    uint64_t *door = tilePlane(planes, TILE_CLASS_DOOR);
+    uint64_t *passable = tilePlane(planes, TILE_CLASS_PASSABLE);
+    memset(planes->words, 0, TILE_CLASS_COUNT * planes->planeWords * sizeof(uint64_t));
+
+    for (int y = 0; y < planes->rows; y++) {
+        for (int x = 0; x < planes->cols; x++) {
+            size_t word = planeWord(planes, planes->words, y, x / 64) - planes->words;
+            uint64_t bit = (uint64_t)1 << (x % 64);
+            int tile = getTile(map, x, y);
+            wall[word] |= (tile == TILE_WALL_HORIZONTAL || tile == TILE_WALL_VERTICAL) ? bit : 0;
+            floor[word] |= (tile == TILE_FLOOR) ? bit : 0;
+            corridor[word] |= (tile == TILE_CORRIDOR) ? bit : 0;
+            door[word] |= (tile == TILE_DOOR) ? bit : 0;
+        }
+    }
+    for (size_t i = 0; i < planes->planeWords; i++) {
+        passable[i] = floor[i] | corridor[i] | door[i];
     }
-    return 0;
 }
 
+// Returns 64 tiles' worth of a plane as seen from each tile's east neighbour
+uint64_t eastWord(const uint64_t *word) {
+    return (word[0] >> 1) | (word[1] << 63);
+}
 
-/// TODO: optimize code to only look at indices where door indicators are (see output of placeCorridors)
-// note: this function currently doesn't return anything, but it could return an array of points representing doors
-//       which could be used to signal to the game that the player is in a given room/corridor
-void placeDoors(char matrix[ROWS][COLS], int maxDoors) {
-    // struct Point *doors = malloc(maxDoors * sizeof(struct Point));
-    int placed = 0;
-    for (int i = 1; i < ROWS - 1; i++) {
-        for (int j = 1; j < COLS - 1; j++) {
-            // Check if the cell is a wall
-            if (matrix[i][j] == '-' || matrix[i][j] == '|') {
-                // Check the eight neighbors
-                int left = isQorPeriod(matrix[i-1][j]);
-                int right = isQorPeriod(matrix[i+1][j]);
-                int up = isQorPeriod(matrix[i][j-1]);
-                int down = isQorPeriod(matrix[i][j+1]);
-                int topLeft = isWallOrPeriod(matrix[i-1][j-1]);
-                int topRight = isWallOrPeriod(matrix[i-1][j+1]);
-                int bottomLeft = isWallOrPeriod(matrix[i+1][j-1]);
-                int bottomRight = isWallOrPeriod(matrix[i+1][j+1]);
-                if (left + right + up + down + topLeft + topRight + bottomLeft + bottomRight == 4) {
-                    // Precisely 2 neighbors are letters, so place a door
-                    matrix[i][j] = '%';
-                    // doors[placed] = (struct Point) {j, i};
-                    placed++;
-
-                    // change corridor end to regular corridor tile
-                    if(isQuestionMark(matrix[i-1][j])) // to the left 
-                    {
-                        matrix[i-1][j] = '#';
-                    } 
-                    else if (isQuestionMark(matrix[i+1][j])) // to the right
-                    {
-                        matrix[i+1][j] = '#';
-                    } else if (isQuestionMark(matrix[i][j-1])) // above
-                    {
-                        matrix[i][j-1] = '#';
-                    } else if (isQuestionMark(matrix[i][j+1])) // below
-                    {
-                        matrix[i][j+1] = '#';
-                    }
-                }
+// Returns 64 tiles' worth of a plane as seen from each tile's west neighbour
+uint64_t westWord(const uint64_t *word) {
+    return (word[0] << 1) | (word[-1] >> 63);
+}
+
+/**
+ * Marks every tile that has exactly count of its eight neighbours in a plane.
+ *
+ * The eight neighbour words are added bit-sliced, so each word of the result
+ * answers the question for 64 tiles at once with no per-tile branches.
+ *
+ * @param planes The planes the plane belongs to.
+ * @param out Receives the result, one bit per tile, a plane of planeWords words.
+ * @param plane The bitset whose members are counted.
+ * @param count The exact number of neighbours wanted, 0 to 8.
+ */
+void exactlyNeighbors8(struct TilePlanes *planes, uint64_t *out, uint64_t *plane, int count) {
+    int stride = planes->stride;
+    for (int y = 0; y < planes->rows; y++) {
+        for (int word = 0; word < planes->wordsPerRow; word++) {
+            const uint64_t *here = planeWord(planes, plane, y, word);
+            const uint64_t *above = here - stride, *below = here + stride;
+            uint64_t neighbors[8] = {
+                westWord(above), above[0], eastWord(above), westWord(here),
+                eastWord(here), westWord(below), below[0], eastWord(below)
+            };
+            uint64_t ones = 0, twos = 0, fours = 0, eights = 0; // bit-sliced neighbour count
+            for (int i = 0; i < 8; i++) {
+                uint64_t carryTwos = ones & neighbors[i];
+                ones ^= neighbors[i];
+                uint64_t carryFours = twos & carryTwos;
+                twos ^= carryTwos;
+                eights |= fours & carryFours;
+                fours ^= carryFours;
             }
+            uint64_t match = ((count & 1) ? ones : ~ones) & ((count & 2) ? twos : ~twos)
+                           & ((count & 4) ? fours : ~fours) & ((count & 8) ? eights : ~eights);
+            // the bits past the map's last column are not tiles
+            uint64_t real = word == planes->wordsPerRow - 1 ? planes->lastWordMask : ~(uint64_t)0;
+            *planeWord(planes, out, y, word) = match & real;
+        }
+    }
+}
+
+/**
+ * Marks every door that joins a room to a corridor: floor on one side of it and
+ * corridor on the opposite side.
+ *
+ * @param planes The planes built from the map.
+ * @param out Receives the result, one bit per tile, a plane of planeWords words.
+ */
+void validDoors(struct TilePlanes *planes, uint64_t *out) {
+    uint64_t *floor = tilePlane(planes, TILE_CLASS_FLOOR);
+    uint64_t *corridor = tilePlane(planes, TILE_CLASS_CORRIDOR);
+    uint64_t *door = tilePlane(planes, TILE_CLASS_DOOR);
+    int stride = planes->stride;
+    for (int y = 0; y < planes->rows; y++) {
+        for (int word = 0; word < planes->wordsPerRow; word++) {
+            const uint64_t *f = planeWord(planes, floor, y, word);
+            const uint64_t *c = planeWord(planes, corridor, y, word);
+            uint64_t vertical = (f[-stride] & c[stride]) | (f[stride] & c[-stride]);
+            uint64_t horizontal = (westWord(f) & eastWord(c)) | (eastWord(f) & westWord(c));
+            *planeWord(planes, out, y, word) = *planeWord(planes, door, y, word) & (vertical | horizontal);
         }
     }
-    // return doors;
 }
 
+// Returns the number of tiles set in a plane
+long countPlane(struct TilePlanes *planes, uint64_t *plane) {
+    long count = 0;
+    for (size_t i = 0; i < planes->planeWords; i++) {
+        count += __builtin_popcountll(plane[i]);
+    }
+    return count;
+}
+#endif
+
 
 //// TODO: use this function to detect when a player is in a room and to display it 
 //         and its contents (monsters, exists, treasure, etc.)
-int detectPlayerRoom(struct Rectangle *rooms, int roomCount, struct Point playerLocation) {
-    for (int i = 0; i < roomCount; i++) {
-        struct Rectangle room = rooms[i];
-        // Check if the player is in the current room
-        if (playerLocation.x >= room.xPos && playerLocation.x < room.xPos + room.width &&
-            playerLocation.y >= room.yPos && playerLocation.y < room.yPos + room.height) {
-            // Return the index of the room the player is in
-            return i;
-        }
+// Every room lies inside its own grid cell, so only the room of the player's cell can hold them
+int detectPlayerRoom(const struct RoomTable *rooms, struct Point playerLocation) {
+    int cell = playerLocation.y / CELL_ROWS * rooms->gridCols + playerLocation.x / CELL_COLS;
+    int room = rooms->roomOfQuadrant[cell];
+    if (room != -1 && pointInRect(roomRect(rooms, room), playerLocation)) {
+        return room;
     }
     // Return -1 if the player is not in any room
     return -1;
@@ -1010,20 +2016,22 @@ int detectPlayerRoom(struct Rectangle *rooms, int roomCount, struct Point player
 
 
 // function that could be useful for painting "fog of war"
-void fillRectWithStars(char matrix[][COLS], struct Rectangle *rects, int rectIndex, char fillChar) {
-    struct Rectangle rect = rects[rectIndex];
+int fillRectWithStars(struct TileMap *map, const struct RoomTable *rooms, int roomIndex, int fillTile) {
+    struct Rectangle rect = roomRect(rooms, roomIndex);
+    int ok = 1;
     for (int x = rect.xPos + 1; x < rect.xPos + rect.width - 1; x++) {
         for (int y = rect.yPos + 1; y < rect.yPos + rect.height - 1; y++) {
-            matrix[y][x] = fillChar;
+            ok &= setTile(map, x, y, fillTile);
         }
     }
+    return ok;
 }
 
 
-struct Point randomPointInRectangle(struct Rectangle rect) {
+struct Point randomPointInRectangle(struct Generator *gen, struct Rectangle rect) {
     struct Point point;
-    point.x = rect.xPos + 1 + rand() % (rect.width - 2);
-    point.y = rect.yPos + 1 + rand() % (rect.height - 2);
+    point.x = rect.xPos + 1 + rngRange(&gen->placementRng, rect.width - 2);
+    point.y = rect.yPos + 1 + rngRange(&gen->placementRng, rect.height - 2);
     return point;
 }
 
@@ -1042,16 +2050,14 @@ struct Point bottomRightCornerOfRectangle(struct Rectangle rect) {
 }
 
 // returns an array of ints where each index i is the 
-// number of connections room i has
-int* countConnections(int numRooms, int connections[][numRooms]) {
-    int* connectionsCount = malloc(numRooms * sizeof(int));
-    for (int i = 0; i < numRooms; i++) {
-        connectionsCount[i] = 0;
-        for (int j = 0; j < numRooms; j++) {
-            if (connections[i][j]) {
-                connectionsCount[i]++;
-            }
-        }
+// number of connections room i has, NULL if memory could not be allocated
+int* countConnections(const struct RoomGraph *graph) {
+    int* connectionsCount = malloc(graph->numRooms * sizeof(int));
+    if (connectionsCount == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < graph->numRooms; i++) {
+        connectionsCount[i] = roomDegree(graph, i);
     }
     return connectionsCount;
 }
@@ -1106,225 +2112,3356 @@ int findMinConnectedRoomOfNonIgnoredRooms(int* arr, int length, int ignoreIndex1
 //         that exists in the room, such as monsters, treasure, exits, etc.
 
 
-int countRooms(int quadsUsed[9]) {
-    int count = 0;
-    for (int i = 0; i < 9; i++) {
-        if (quadsUsed[i] != -1) {
-            count++;
-        }
-    }
-    return count;
+int countRooms(int quadMask) {
+    return __builtin_popcount(quadMask);
 }
 
 
-int main()
-{
-    // At the start of the level setup
-    clock_t start = clock(); // time profiling 1
-    
-    printf("Welcome to Rogue Study!\n");
-
-    // change back when in prod 
-    randomSeed = time(NULL);
-    // srand(fixedSeed);
-    srand(randomSeed);
-    // printf("Fixed seed: %d\n", fixedSeed);
-    printf("Random seed: %d\n", randomSeed);
-    char matrix[ROWS][COLS]; // the board
-    char input; // character move input: 'wasd' or 'q'
-    // initialize display message that gives player info regarding out of bounds, etc.
-    char message[80];
-    strcpy(message, "");
-    // initialize player 1 at 0,0
-    // DONE: make playerLocation a Point struct
-    // DONE: set player's location to be in a room (make sure to prevent placement on a wall)
-    // DONE: set player's location to be in the "first room" which may be farther away 
-    // from the level end, or simply just in room #0 (went with topleft room for now)
-    struct Point playerLocation = {-1, -1};
-    struct Point exitLocation = {-1, -1};
-    struct Point treasureLocation = {-1, -1};
-    // store the tile type the player is on currently
-    char playerCell = '?';
-
-    struct Rectangle *rooms;
-    struct Rectangle topLeftRoom;
-    int indexOfTopLeftRoom;
-    int treasureRoomIndex;
-    struct Rectangle *corridors; // the collection of hallways connecting the rooms
-    int* connectionsCount; // an array of ints where each index i is the number of connections room i has
-    int dynamicRoomCount = 0;
-    numRooms = rand() % 5 + 5; // Random number of rooms between 5 and 9
-    int connections[numRooms][numRooms]; // an adjacency matrix to store connections between rooms
-
-    // setup loop to generate a level
-    while(1) {
-        // clear the board
-        fillMatrix(matrix, ROWS, COLS, ' ');
+void freeGenerator(struct Generator *gen) {
+    free(gen->cellScratch);
+    free(gen->openScratch);
+    free(gen->tileQueue);
+    gen->cellScratch = NULL;
+    gen->openScratch = NULL;
+    gen->tileQueue = NULL;
+}
 
-        // place rooms
-        rooms = placeRooms(matrix);
+/**
+ * Sets up a generator for a grid of gridCols x gridRows cells.
+ *
+ * Each cell is CELL_COLS x CELL_ROWS tiles and holds at most one room. The 3x3
+ * grid draws its layouts and corridors from the precomputed tables, any other
+ * grid grows them at random. Set stageNanos afterwards to time the stages.
+ *
+ * @param gen The generator to initialize, release it with freeGenerator.
+ * @param gridCols The number of cells across the map.
+ * @param gridRows The number of cells down the map.
+ * @return 1 on success, 0 if the grid is too small or memory could not be allocated.
+ */
+int initGenerator(struct Generator *gen, int gridCols, int gridRows) {
+    memset(gen, 0, sizeof(*gen));
+    // the start, exit and treasure each need a room of their own
+    if (gridCols < 1 || gridRows < 1 || gridCols * gridRows < 4) {
+        printf("Error: a %dx%d grid is too small, it needs at least 4 cells\n", gridCols, gridRows);
+        return 0;
+    }
+    // room indices have to fit the 16-bit entries of a RoomGraph, and tile
+    // coordinates the 16-bit fields of a RoomTable
+    if ((long)gridCols * gridRows > 65536 || (long)gridCols * CELL_COLS > 65535 || (long)gridRows * CELL_ROWS > 65535) {
+        printf("Error: a %dx%d grid is too large, it can have at most 65536 cells and 65535 tiles across\n", gridCols, gridRows);
+        return 0;
+    }
+    int cells = gridCols * gridRows;
+    gen->gridCols = gridCols;
+    gen->gridRows = gridRows;
+    gen->cellScratch = malloc(4 * cells * sizeof(int));
+    size_t tiles = (size_t)gridRows * CELL_ROWS * gridCols * CELL_COLS;
+    gen->openScratch = malloc(2 * (size_t)(gridRows * CELL_ROWS + 2) * (gridCols * CELL_COLS + 2));
+    gen->tileQueue = malloc(tiles * sizeof(int));
+    if (gen->cellScratch == NULL || gen->openScratch == NULL || gen->tileQueue == NULL) {
+        freeGenerator(gen);
+        return 0;
+    }
+    for (int pair = 0; pair < 256; pair++) {
+        gen->openPairs[pair][0] = tileProperties[(pair & 0xf) % TILE_TYPE_COUNT] & TILE_PASSABLE;
+        gen->openPairs[pair][1] = tileProperties[(pair >> 4) % TILE_TYPE_COUNT] & TILE_PASSABLE;
+    }
+    return 1;
+}
 
 
-        // debugging
-        // printMatrix(matrix, ROWS, COLS);
+// Fills in gen->openScratch from the map: 1 where a tile is passable, 0 elsewhere and on the border
+void markOpenTiles(struct Generator *gen, const struct TileMap *map) {
+    int stride = map->cols + 2;
+    memset(gen->openScratch, 0, (size_t)(map->rows + 2) * stride);
+    for (int y = 0; y < map->rows; y++) {
+        unsigned char *row = gen->openScratch + (size_t)(y + 1) * stride + 1;
+        // decode each chunk's slice of the row directly, two tiles per byte; blank chunks stay 0
+        for (int chunkX = 0; chunkX < map->chunkCols; chunkX++) {
+            const unsigned char *chunk = map->chunks[(y >> CHUNK_SHIFT) * map->chunkCols + chunkX];
+            if (chunk == NULL) {
+                continue;
+            }
+            const unsigned char *packed = chunk + (((y & CHUNK_MASK) << CHUNK_SHIFT) >> 1);
+            int first = chunkX << CHUNK_SHIFT;
+            int width = map->cols - first < CHUNK_SIZE ? map->cols - first : CHUNK_SIZE;
+            for (int x = 0; x + 1 < width; x += 2) {
+                memcpy(row + first + x, gen->openPairs[packed[x >> 1]], 2);
+            }
+            if (width & 1) {
+                row[first + width - 1] = gen->openPairs[packed[width >> 1]][0];
+            }
+        }
+    }
+}
 
-        dynamicRoomCount = countRooms(quadrantsUsed);
+/**
+ * Fills in the walking distance from every tile to one tile, a breadth-first
+ * search over the tiles markOpenTiles marked (every step costs the same, so
+ * this is Dijkstra's algorithm without the heap).
+ *
+ * @param gen The generator, with openScratch filled in for map.
+ * @param map The map.
+ * @param source The tile to measure distances to.
+ * @param field Filled in with rows * cols distances, row by row; DISTANCE_UNREACHABLE
+ *              for tiles that can't reach source, and capped at DISTANCE_UNREACHABLE - 1.
+ */
+void buildDistanceField(struct Generator *gen, const struct TileMap *map, struct Point source, uint16_t *field) {
+    int stride = map->cols + 2;
+    const int openSteps[4] = {-stride, 1, stride, -1};
+    memset(field, 0xff, (size_t)map->rows * map->cols * sizeof(uint16_t)); // DISTANCE_UNREACHABLE
+    // a tile is closed in the working copy once queued, so each neighbour costs one test
+    size_t padded = (size_t)(map->rows + 2) * stride;
+    unsigned char *open = gen->openScratch + padded;
+    memcpy(open, gen->openScratch, padded);
+    // the queue holds each tile's place in openScratch, one int per tile; a tile at
+    // padded index p sits on row p / stride - 1, so its place in field is p - stride + 1 - 2 * (p / stride)
+    int *queue = gen->tileQueue;
+    int head = 0, tail = 0;
+    queue[tail++] = (source.y + 1) * stride + source.x + 1;
+    open[queue[0]] = 0;
+    field[source.y * map->cols + source.x] = 0;
+    // one layer of the search at a time, so the distance never has to be read back
+    for (int distance = 1; head < tail; distance++) {
+        uint16_t stored = distance < DISTANCE_UNREACHABLE ? distance : DISTANCE_UNREACHABLE - 1;
+        for (int layerEnd = tail; head < layerEnd; head++) {
+            int from = queue[head];
+            for (int i = 0; i < 4; i++) {
+                int next = from + openSteps[i];
+                // the border is never open, so next stays on the map
+                if (open[next]) {
+                    open[next] = 0;
+                    field[next - stride + 1 - 2 * (next / stride)] = stored;
+                    queue[tail++] = next;
+                }
+            }
+        }
+    }
+}
 
-        // debug 7
-        // printf("There are %d rooms\n", dynamicRoomCount);
+/**
+ * Gives a generated level its distance fields. generateLevel leaves them out:
+ * they take longer to build than the rest of the level and cost 4 bytes a tile,
+ * so only the levels that are played with the sensor, cached or packed get them.
+ *
+ * @param gen The generator the level came from, for its scratch space.
+ * @param level The level, which keeps any fields it already has.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int buildDistanceFields(struct Generator *gen, struct Level *level) {
+    if (level->exitDistances != NULL) {
+        return 1;
+    }
+    size_t tiles = (size_t)level->tiles.rows * level->tiles.cols;
+    uint16_t *exitDistances = malloc(tiles * sizeof(uint16_t));
+    uint16_t *treasureDistances = malloc(tiles * sizeof(uint16_t));
+    if (exitDistances == NULL || treasureDistances == NULL) {
+        free(exitDistances);
+        free(treasureDistances);
+        return 0;
+    }
+    markOpenTiles(gen, &level->tiles);
+    buildDistanceField(gen, &level->tiles, level->exitLocation, exitDistances);
+    buildDistanceField(gen, &level->tiles, level->treasureLocation, treasureDistances);
+    level->exitDistances = exitDistances;
+    level->treasureDistances = treasureDistances;
+    return 1;
+}
 
-        // find the top left room
-        topLeftRoom = findTopLeftRoom(rooms, dynamicRoomCount);
+// Returns the steps from a tile to the exit, DISTANCE_UNREACHABLE if it can't get there;
+// the level needs its distance fields
+int distanceToExit(const struct Level *level, struct Point point) {
+    return level->exitDistances[point.y * level->tiles.cols + point.x];
+}
 
-        // get the topLeftRoom index
-        indexOfTopLeftRoom = getRoomIndexFromRect(topLeftRoom, rooms, dynamicRoomCount);
+// Returns the steps from a tile to where the treasure was placed, DISTANCE_UNREACHABLE if it can't get there
+int distanceToTreasure(const struct Level *level, struct Point point) {
+    return level->treasureDistances[point.y * level->tiles.cols + point.x];
+}
 
-        // debug 9
-        // printf("The upper left most room is room %c at room index %d which is at roomQuadrant %d\n",
-        //  rooms[indexOfTopLeftRoom].wallChar, indexOfTopLeftRoom, rooms[indexOfTopLeftRoom].wallChar - '0');
+/**
+ * Runs every stage of generateLevel, stopping at the first allocation that fails.
+ *
+ * @param gen The generator context to use.
+ * @param seed The random seed for the level.
+ * @param out The level to fill in, zeroed beforehand so a partial level can be freed.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int buildLevel(struct Generator *gen, uint64_t seed, struct Level *out) {
+    gen->randomSeed = seed;
+    rngSeed(&gen->roomsRng, seed, STREAM_ROOMS);
+    rngSeed(&gen->corridorsRng, seed, STREAM_CORRIDORS);
+    rngSeed(&gen->placementRng, seed, STREAM_PLACEMENT);
+    // between 5/9 of the cells and all of them hold a room, 5 to 9 rooms on the 3x3 grid
+    int cells = gen->gridCols * gen->gridRows;
+    int minRooms = intMax(cells * 5 / 9, 3);
+    gen->numRooms = rngRange(&gen->roomsRng, cells - minRooms + 1) + minRooms;
+
+    // start from a blank board
+    if (!initTileMap(&out->tiles, gen->gridRows * CELL_ROWS, gen->gridCols * CELL_COLS)) {
+        return 0;
+    }
+    struct TileMap *map = &out->tiles;
 
-        // print the details of the top left room (debugging message)
-        // printRoomDetails(matrix, rooms, indexOfTopLeftRoom);
+    // place rooms
+    long long stageStart = gen->stageNanos ? monotonicNanos() : 0;
+    out->roomCount = gen->numRooms;
+    int roomCount = out->roomCount;
+    if (!initRoomTable(&out->rooms, roomCount, gen->gridCols, gen->gridRows)) {
+        return 0;
+    }
+    if (!placeRooms(gen, map, &out->rooms)) {
+        return 0;
+    }
 
-        // place corridors
-        corridors = placeCorridors(matrix, rooms, dynamicRoomCount, connections);
+    // find the top left room
+    out->startRoomIndex = findTopLeftRoom(&out->rooms);
+    stageStart = endStage(gen, STAGE_PLACE_ROOMS, stageStart);
 
-        // printf("Ending room and corridor generation...\n");
-        break;
+    // place corridors
+    out->corridorEnds = malloc(4 * roomCount * sizeof(struct CorridorEnd));
+    if (out->corridorEnds == NULL) {
+        return 0;
     }
-
-    printf("Room gen epoch: %d\n", epochs);
+    out->corridors = placeCorridors(gen, map, &out->rooms, out->corridorEnds, &out->corridorCount,
+                                    &out->corridorRuns, &out->corridorRunCount);
+    if (out->corridors == NULL || !buildRoomGraph(&out->connections, roomCount, out->corridorEnds, out->corridorCount)) {
+        return 0;
+    }
+    struct RoomGraph *connections = &out->connections;
+    stageStart = endStage(gen, STAGE_PLACE_CORRIDORS, stageStart);
 
     // denote the farthest room from the player's initial starting room
-    int farthestRoomIndex = farthestRoom(indexOfTopLeftRoom, dynamicRoomCount, connections);
-    // printf("The farthest room from the top left room is room %c at room index %d which is at roomQuadrant %d\n",
-    //   rooms[farthestRoomIndex].wallChar, farthestRoomIndex, rooms[farthestRoomIndex].wallChar - '0');
+    out->exitRoomIndex = farthestRoom(out->startRoomIndex, connections, gen->cellScratch);
+    stageStart = endStage(gen, STAGE_FARTHEST_ROOM, stageStart);
 
     // place doors
-    placeDoors(matrix, MAX_ROOM_COUNT * 2);
+    out->doors = placeDoors(map, out->corridorEnds, 2 * out->corridorCount);
+    if (out->doors == NULL) {
+        return 0;
+    }
+    stageStart = endStage(gen, STAGE_PLACE_DOORS, stageStart);
 
-    // mark top left room as "visible" by filling it with stars
-    // uncomment this line when not debugging
-    // fillRectWithStars(matrix, rooms, indexOfTopLeftRoom, '*');
-    
-    // initially place player onto the board
-    playerLocation.x = topLeftRoom.xPos+2;
-    playerLocation.y = topLeftRoom.yPos+2;
-    playerCell = matrix[playerLocation.y][playerLocation.x];
-    matrix[playerLocation.y][playerLocation.x] = PLAYER_CHAR;
+    // the player starts near the top left of the top left room
+    out->playerLocation.x = out->rooms.x[out->startRoomIndex] + 2;
+    out->playerLocation.y = out->rooms.y[out->startRoomIndex] + 2;
 
     //// TODO: place exit in corner of farthest room, where the corner 
     //         is the farthest corner from the player's starting position
-    // place exit onto the board for now
-    exitLocation = bottomRightCornerOfRectangle(rooms[farthestRoomIndex]);
-    matrix[exitLocation.y][exitLocation.x] = EXIT_CHAR;
-
+    out->exitLocation = bottomRightCornerOfRectangle(roomRect(&out->rooms, out->exitRoomIndex));
+    if (!setTile(map, out->exitLocation.x, out->exitLocation.y, TILE_EXIT)) {
+        return 0;
+    }
+
     // count the number of connections each room has
-    connectionsCount = countConnections(dynamicRoomCount, connections);
-    // debugging message
-    // for (int i = 0; i < dynamicRoomCount; i++) {
-    //     printf("--- Room %d at quad %d has %d connections\n", i, rooms[i].wallChar - '0', connectionsCount[i]);
-    // }
+    out->connectionsCount = countConnections(connections);
+    if (out->connectionsCount == NULL) {
+        return 0;
+    }
+    stageStart = endStage(gen, STAGE_PLACE_EXIT_TREASURE, stageStart);
+
+    int farthestFromExit = farthestRoom(out->exitRoomIndex, connections, gen->cellScratch);
+    stageStart = endStage(gen, STAGE_FARTHEST_ROOM, stageStart);
+    if(farthestFromExit == out->startRoomIndex) {
+        //// TODO: fix bug where the treasure is sometimes placed in the starting room
+        out->treasureRoomIndex = findMinConnectedRoomOfNonIgnoredRooms(out->connectionsCount, roomCount, out->startRoomIndex, out->exitRoomIndex);
+    } else {
+        out->treasureRoomIndex = farthestFromExit;
+    }
+
+    // place the treasure in the treasureRoom
+    out->treasureLocation = centerPointOfRectangle(roomRect(&out->rooms, out->treasureRoomIndex));
+    if (!setTile(map, out->treasureLocation.x, out->treasureLocation.y, TILE_TREASURE)) {
+        return 0;
+    }
+    endStage(gen, STAGE_PLACE_EXIT_TREASURE, stageStart);
+
+    return 1;
+}
+
+
+/**
+ * Releases everything generateLevel or loadPackedLevel allocated for a level.
+ *
+ * @param level The level to free.
+ */
+void freeLevel(struct Level *level) {
+    if (level->pack != NULL) {
+        // levels are never written after loading, so only the chunk table is the level's own
+        free(level->tiles.chunks);
+        level->tiles.chunks = NULL;
+        return;
+    }
+    freeTileMap(&level->tiles);
+    freeRoomTable(&level->rooms);
+    free(level->corridors);
+    free(level->corridorRuns);
+    free(level->corridorEnds);
+    free(level->doors);
+    freeRoomGraph(&level->connections);
+    free(level->connectionsCount);
+    free(level->exitDistances);
+    free(level->treasureDistances);
+    level->exitDistances = NULL;
+    level->treasureDistances = NULL;
+    level->corridors = NULL;
+    level->corridorRuns = NULL;
+    level->corridorEnds = NULL;
+    level->doors = NULL;
+    level->connectionsCount = NULL;
+}
+
+/**
+ * Generates a complete level from a seed.
+ *
+ * Resets the generator, then places the rooms, corridors and doors, and picks the
+ * player's starting point, the exit and the treasure. All state lives in gen and
+ * out, so separate threads may each generate levels with their own pair. The
+ * level has no distance fields until buildDistanceFields is called on it.
+ *
+ * @param gen The generator context to use.
+ * @param seed The random seed for the level, see levelSeed for levels of a run.
+ * @param out The level to fill in, release it with freeLevel.
+ * @return 1 on success, 0 if memory could not be allocated, in which case
+ *         nothing is left for the caller to free.
+ */
+int generateLevel(struct Generator *gen, uint64_t seed, struct Level *out) {
+    memset(out, 0, sizeof(*out));
+    if (!buildLevel(gen, seed, out)) {
+        freeLevel(out);
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+Level packs: many generated levels in one binary file, laid out so a reader can
+mmap the file and point a Level straight at the arrays in it.
+
+A pack starts with a PackHeader and levelCount PackIndexEntry records sorted by
+seed. Each level is a PackedLevel followed by its arrays, every array starting
+on an 8-byte boundary:
+
+    chunk slots       uint64 per map chunk: offset of its packed tiles, 0 if blank
+    chunks            CHUNK_SIZE * CHUNK_SIZE / 2 bytes each, as in TileMap
+    room fields       uint16 x, y, width, height and quadrant, roomCount each
+    roomOfQuadrant    int32 per grid cell
+    corridors         PackedCorridor per corridor
+    corridorRuns      uint8 direction and length, corridorRunCount of them
+    corridorEnds      PackedCorridorEnd, 2 per corridor
+    doors             PackedPoint, 2 per corridor
+    graph offsets     int32, roomCount + 1 of them, as in RoomGraph
+    graph neighbors   uint16, 2 per corridor
+    connectionsCount  int32 per room
+    exitDistances     uint16 per tile
+    treasureDistances uint16 per tile
+
+Every record is made of fixed-width fields with no padding. The structs a Level
+holds have the same layout, which the asserts below check at compile time, so
+a reader points a Level at the arrays in place. All offsets count from the
+start of the file. Values are in the writer's byte order, so a pack is rejected
+on a machine whose byte order differs.
+*/
+#define PACK_MAGIC "RGPK"
+#define PACK_VERSION 3 // 2 added the distance fields, 3 stores corridors as polylines
+#define PACK_BYTE_ORDER 0x01020304u
+
+struct PackHeader {
+    char magic[4]; // PACK_MAGIC
+    uint32_t version; // PACK_VERSION
+    uint32_t byteOrder; // PACK_BYTE_ORDER as the writer stored it
+    uint32_t levelCount;
+};
+
+struct PackIndexEntry {
+    uint64_t seed;
+    uint64_t offset; // where the level's PackedLevel starts
+};
+
+// A Point on disk
+struct PackedPoint {
+    int32_t x;
+    int32_t y;
+};
+
+// A Corridor on disk
+struct PackedCorridor {
+    int32_t startX;
+    int32_t startY;
+    int32_t firstRun;
+    int32_t runCount;
+    int32_t rooms[2];
+};
+
+// A CorridorEnd on disk
+struct PackedCorridorEnd {
+    int32_t x;
+    int32_t y;
+    int32_t room;
+    int32_t wall;
+};
+
+// loadPackedLevel reads these records in place as the structs a Level holds
+_Static_assert(sizeof(int) == sizeof(int32_t), "packed int arrays are int32");
+_Static_assert(sizeof(struct Point) == sizeof(struct PackedPoint)
+               && offsetof(struct Point, y) == offsetof(struct PackedPoint, y), "Point differs from PackedPoint");
+_Static_assert(sizeof(struct Corridor) == sizeof(struct PackedCorridor)
+               && offsetof(struct Corridor, start.y) == offsetof(struct PackedCorridor, startY)
+               && offsetof(struct Corridor, firstRun) == offsetof(struct PackedCorridor, firstRun)
+               && offsetof(struct Corridor, runCount) == offsetof(struct PackedCorridor, runCount)
+               && offsetof(struct Corridor, rooms) == offsetof(struct PackedCorridor, rooms),
+               "Corridor differs from PackedCorridor");
+_Static_assert(sizeof(struct CorridorEnd) == sizeof(struct PackedCorridorEnd)
+               && offsetof(struct CorridorEnd, point.y) == offsetof(struct PackedCorridorEnd, y)
+               && offsetof(struct CorridorEnd, room) == offsetof(struct PackedCorridorEnd, room)
+               && offsetof(struct CorridorEnd, wall) == offsetof(struct PackedCorridorEnd, wall),
+               "CorridorEnd differs from PackedCorridorEnd");
+_Static_assert(sizeof(struct CorridorRun) == 2, "CorridorRun is two bytes");
+
+struct PackedLevel {
+    uint64_t seed;
+    uint64_t size; // bytes from here to the end of the level's last array
+    int32_t gridCols;
+    int32_t gridRows;
+    int32_t roomCount;
+    int32_t corridorCount;
+    int32_t corridorRunCount;
+    int32_t startRoomIndex;
+    int32_t exitRoomIndex;
+    int32_t treasureRoomIndex;
+    int32_t allocatedChunks;
+    struct PackedPoint playerLocation;
+    struct PackedPoint exitLocation;
+    struct PackedPoint treasureLocation;
+    int32_t reserved; // 0, keeps the offsets below on an 8-byte boundary
+    uint64_t chunkSlots;
+    uint64_t roomFields;
+    uint64_t roomOfQuadrant;
+    uint64_t corridors;
+    uint64_t corridorRuns;
+    uint64_t corridorEnds;
+    uint64_t doors;
+    uint64_t graphOffsets;
+    uint64_t graphNeighbors;
+    uint64_t connectionsCount;
+    uint64_t exitDistances;
+    uint64_t treasureDistances;
+};
+
+// Returns where an array of size bytes goes in a pack, moving end past it
+uint64_t packSection(uint64_t *end, size_t size) {
+    uint64_t start = (*end + 7) & ~(uint64_t)7;
+    *end = start + size;
+    return start;
+}
+
+// Writes an array at the offset packSection gave it, padding up to it with zeros
+int writePackSection(FILE *file, uint64_t *position, uint64_t offset, const void *data, size_t size) {
+    static const char padding[8] = {0};
+    if (fwrite(padding, 1, offset - *position, file) != offset - *position
+        || fwrite(data, 1, size, file) != size) {
+        return 0;
+    }
+    *position = offset + size;
+    return 1;
+}
+
+/**
+ * Appends a generated level to a pack file.
+ *
+ * @param file The pack, positioned at offset position.
+ * @param position The current offset in the pack, moved past the level.
+ * @param level The level to write.
+ * @param seed The seed it was generated from.
+ * @return 1 on success, 0 if writing failed.
+ */
+int writePackedLevel(FILE *file, uint64_t *position, const struct Level *level, uint64_t seed) {
+    const struct TileMap *map = &level->tiles;
+    int slots = map->chunkRows * map->chunkCols;
+    int corridors = level->corridorCount;
+    int roomCount = level->roomCount;
+    // zeroed first so the header's padding is written as zeros too
+    struct PackedLevel packed;
+    memset(&packed, 0, sizeof(packed));
+    packed.seed = seed;
+    packed.gridCols = level->rooms.gridCols;
+    packed.gridRows = level->rooms.cells / level->rooms.gridCols;
+    packed.roomCount = roomCount;
+    packed.corridorCount = corridors;
+    packed.corridorRunCount = level->corridorRunCount;
+    packed.startRoomIndex = level->startRoomIndex;
+    packed.exitRoomIndex = level->exitRoomIndex;
+    packed.treasureRoomIndex = level->treasureRoomIndex;
+    packed.allocatedChunks = map->allocatedChunks;
+    packed.playerLocation = (struct PackedPoint) {level->playerLocation.x, level->playerLocation.y};
+    packed.exitLocation = (struct PackedPoint) {level->exitLocation.x, level->exitLocation.y};
+    packed.treasureLocation = (struct PackedPoint) {level->treasureLocation.x, level->treasureLocation.y};
+
+    // lay the level out first, so its header can go in front of its arrays
+    uint64_t start = (*position + 7) & ~(uint64_t)7;
+    uint64_t end = start + sizeof(packed);
+    uint64_t *chunkOffsets = malloc(slots * sizeof(uint64_t));
+    if (chunkOffsets == NULL) {
+        return 0;
+    }
+    packed.chunkSlots = packSection(&end, slots * sizeof(uint64_t));
+    for (int i = 0; i < slots; i++) {
+        chunkOffsets[i] = map->chunks[i] ? packSection(&end, CHUNK_SIZE * CHUNK_SIZE / 2) : 0;
+    }
+    packed.roomFields = packSection(&end, 5 * roomCount * sizeof(uint16_t));
+    packed.roomOfQuadrant = packSection(&end, level->rooms.cells * sizeof(int));
+    packed.corridors = packSection(&end, corridors * sizeof(struct PackedCorridor));
+    packed.corridorRuns = packSection(&end, level->corridorRunCount * sizeof(struct CorridorRun));
+    packed.corridorEnds = packSection(&end, 2 * corridors * sizeof(struct PackedCorridorEnd));
+    packed.doors = packSection(&end, 2 * corridors * sizeof(struct PackedPoint));
+    packed.graphOffsets = packSection(&end, (roomCount + 1) * sizeof(int));
+    packed.graphNeighbors = packSection(&end, 2 * corridors * sizeof(uint16_t));
+    packed.connectionsCount = packSection(&end, roomCount * sizeof(int));
+    size_t tiles = (size_t)map->rows * map->cols;
+    packed.exitDistances = packSection(&end, tiles * sizeof(uint16_t));
+    packed.treasureDistances = packSection(&end, tiles * sizeof(uint16_t));
+    packed.size = end - start;
+
+    // the corridors, their ends and the doors go out field by field, through one
+    // buffer big enough for the largest of the three
+    struct PackedCorridor *corridorRecords = malloc(2 * corridors * sizeof(struct PackedCorridorEnd));
+    struct PackedCorridorEnd *endRecords = (struct PackedCorridorEnd *)corridorRecords;
+    struct PackedPoint *doorRecords = (struct PackedPoint *)corridorRecords;
+    if (corridorRecords == NULL) {
+        free(chunkOffsets);
+        return 0;
+    }
+
+    int written = writePackSection(file, position, start, &packed, sizeof(packed))
+        && writePackSection(file, position, packed.chunkSlots, chunkOffsets, slots * sizeof(uint64_t));
+    for (int i = 0; i < slots && written; i++) {
+        if (map->chunks[i]) {
+            written = writePackSection(file, position, chunkOffsets[i], map->chunks[i], CHUNK_SIZE * CHUNK_SIZE / 2);
+        }
+    }
+    free(chunkOffsets);
+    written = written
+        && writePackSection(file, position, packed.roomFields, level->rooms.x, 5 * roomCount * sizeof(uint16_t))
+        && writePackSection(file, position, packed.roomOfQuadrant, level->rooms.roomOfQuadrant, level->rooms.cells * sizeof(int));
+    for (int i = 0; i < corridors; i++) {
+        const struct Corridor *c = &level->corridors[i];
+        corridorRecords[i] = (struct PackedCorridor) {c->start.x, c->start.y, c->firstRun, c->runCount,
+                                                      {c->rooms[0], c->rooms[1]}};
+    }
+    written = written
+        && writePackSection(file, position, packed.corridors, corridorRecords, corridors * sizeof(struct PackedCorridor))
+        && writePackSection(file, position, packed.corridorRuns, level->corridorRuns,
+                            level->corridorRunCount * sizeof(struct CorridorRun));
+    for (int i = 0; i < 2 * corridors; i++) {
+        const struct CorridorEnd *e = &level->corridorEnds[i];
+        endRecords[i] = (struct PackedCorridorEnd) {e->point.x, e->point.y, e->room, e->wall};
+    }
+    written = written
+        && writePackSection(file, position, packed.corridorEnds, endRecords, 2 * corridors * sizeof(struct PackedCorridorEnd));
+    for (int i = 0; i < 2 * corridors; i++) {
+        doorRecords[i] = (struct PackedPoint) {level->doors[i].x, level->doors[i].y};
+    }
+    written = written
+        && writePackSection(file, position, packed.doors, doorRecords, 2 * corridors * sizeof(struct PackedPoint));
+    free(corridorRecords);
+    return written
+        && writePackSection(file, position, packed.graphOffsets, level->connections.offsets, (roomCount + 1) * sizeof(int))
+        && writePackSection(file, position, packed.graphNeighbors, level->connections.neighbors, 2 * corridors * sizeof(uint16_t))
+        && writePackSection(file, position, packed.connectionsCount, level->connectionsCount, roomCount * sizeof(int))
+        && writePackSection(file, position, packed.exitDistances, level->exitDistances, tiles * sizeof(uint16_t))
+        && writePackSection(file, position, packed.treasureDistances, level->treasureDistances, tiles * sizeof(uint16_t));
+}
+
+int compareSeeds(const void *a, const void *b) {
+    uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+    return first < second ? -1 : first > second;
+}
+
+/**
+ * Generates a level for every seed and writes them all to a pack file.
+ *
+ * @param path The pack file to create.
+ * @param gen The generator to build the levels with, its grid is the pack's.
+ * @param seeds The seeds to pack, duplicates are packed once.
+ * @param count The number of seeds.
+ * @return The number of levels packed, 0 on failure.
+ */
+int writeLevelPack(const char *path, struct Generator *gen, const uint64_t *seeds, int count) {
+    // the index is sorted by seed, so write the levels in seed order too
+    uint64_t *sorted = malloc(count * sizeof(uint64_t));
+    struct PackIndexEntry *index = malloc(count * sizeof(struct PackIndexEntry));
+    FILE *file = fopen(path, "wb");
+    if (sorted == NULL || index == NULL || file == NULL) {
+        printf("Error: could not create level pack %s\n", path);
+        free(sorted);
+        free(index);
+        if (file) {
+            fclose(file);
+        }
+        return 0;
+    }
+    memcpy(sorted, seeds, count * sizeof(uint64_t));
+    qsort(sorted, count, sizeof(uint64_t), compareSeeds);
+
+    int levelCount = 0;
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || sorted[i] != sorted[i - 1]) {
+            index[levelCount++].seed = sorted[i];
+        }
+    }
+    struct PackHeader header = {PACK_MAGIC, PACK_VERSION, PACK_BYTE_ORDER, levelCount};
+    uint64_t position = sizeof(header) + levelCount * sizeof(struct PackIndexEntry);
+    int written = fseek(file, position, SEEK_SET) == 0;
+    for (int i = 0; i < levelCount && written; i++) {
+        struct Level level;
+        if (!generateLevel(gen, index[i].seed, &level)) {
+            printf("Error: could not allocate the level\n");
+            written = 0;
+            break;
+        }
+        if (!buildDistanceFields(gen, &level)) {
+            printf("Error: could not allocate the level\n");
+            freeLevel(&level);
+            written = 0;
+            break;
+        }
+        index[i].offset = (position + 7) & ~(uint64_t)7;
+        written = writePackedLevel(file, &position, &level, index[i].seed);
+        freeLevel(&level);
+    }
+    written = written && fseek(file, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(index, sizeof(struct PackIndexEntry), levelCount, file) == (size_t)levelCount;
+    if (fclose(file) != 0 || !written) {
+        printf("Error: could not write level pack %s\n", path);
+        levelCount = 0;
+    }
+    free(sorted);
+    free(index);
+    return levelCount;
+}
+
+#ifndef _WIN32
+void closeLevelPack(struct LevelPack *pack) {
+    if (pack->base != NULL) {
+        munmap(pack->base, pack->size);
+        pack->base = NULL;
+    }
+}
+
+/**
+ * Maps a level pack into memory.
+ *
+ * The mapping is read-only: games never write to their level, so any stray
+ * write into a packed level faults instead of going unnoticed.
+ *
+ * @param pack The pack to open, release it with closeLevelPack.
+ * @param path The pack file.
+ * @return 1 on success, 0 if the file could not be mapped or is not a pack.
+ */
+int openLevelPack(struct LevelPack *pack, const char *path) {
+    pack->base = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0) {
+        printf("Error: could not open level pack %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    pack->size = status.st_size;
+    void *base = pack->size >= sizeof(struct PackHeader)
+        ? mmap(NULL, pack->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd); // the mapping keeps the file open
+    if (base == MAP_FAILED) {
+        printf("Error: could not map level pack %s\n", path);
+        return 0;
+    }
+    pack->base = base;
+    const struct PackHeader *header = base;
+    pack->levelCount = header->levelCount;
+    pack->index = (const struct PackIndexEntry *)(header + 1);
+    if (memcmp(header->magic, PACK_MAGIC, 4) != 0 || header->version != PACK_VERSION
+        || header->byteOrder != PACK_BYTE_ORDER
+        || sizeof(*header) + (uint64_t)pack->levelCount * sizeof(struct PackIndexEntry) > pack->size) {
+        printf("Error: %s is not a version %d level pack in this machine's byte order\n", path, PACK_VERSION);
+        closeLevelPack(pack);
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+/**
+ * Finds a level in a pack by its seed, a binary search of the index.
+ *
+ * @param pack The open pack.
+ * @param seed The level's seed.
+ * @return The level's index in the pack, or -1 if the pack doesn't hold it.
+ */
+int findPackedLevel(const struct LevelPack *pack, uint64_t seed) {
+    int low = 0, high = (int)pack->levelCount - 1;
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        if (pack->index[middle].seed == seed) {
+            return middle;
+        } else if (pack->index[middle].seed < seed) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+// Returns 1 if size bytes at offset lie inside the pack and start on an 8-byte boundary
+int packSectionFits(const struct LevelPack *pack, uint64_t offset, uint64_t size) {
+    return offset % 8 == 0 && offset <= pack->size && size <= pack->size - offset;
+}
+
+// Returns 1 if a tile lies on a map of the given size
+int pointOnMap(int x, int y, int rows, int cols) {
+    return x >= 0 && x < cols && y >= 0 && y < rows;
+}
+
+/**
+ * Checks that a packed level's counts are sane, that every array it points to
+ * lies inside the pack, and that every index and tile in those arrays stays in
+ * range, so a truncated or corrupt file is rejected instead of read or walked
+ * past the end of an array.
+ *
+ * @param pack The open pack.
+ * @param packed The level's header, already known to lie inside the pack.
+ * @return 1 if the level can be opened in place, 0 otherwise.
+ */
+int packedLevelFits(const struct LevelPack *pack, const struct PackedLevel *packed) {
+    // the largest grid whose tile count still fits in an int
+    const int64_t maxCells = INT32_MAX / (CELL_ROWS * CELL_COLS);
+    int64_t cells = (int64_t)packed->gridCols * packed->gridRows;
+    int roomCount = packed->roomCount, corridorCount = packed->corridorCount;
+    if (packed->gridCols <= 0 || packed->gridRows <= 0 || packed->gridCols > maxCells
+        || packed->gridRows > maxCells || cells > maxCells
+        || roomCount <= 0 || roomCount > cells
+        || corridorCount < 0 || corridorCount > 2 * roomCount
+        || packed->corridorRunCount < 0 || packed->allocatedChunks < 0
+        || packed->startRoomIndex < 0 || packed->startRoomIndex >= roomCount
+        || packed->exitRoomIndex < 0 || packed->exitRoomIndex >= roomCount
+        || packed->treasureRoomIndex < 0 || packed->treasureRoomIndex >= roomCount) {
+        return 0;
+    }
+    int rows = packed->gridRows * CELL_ROWS, cols = packed->gridCols * CELL_COLS;
+    uint64_t slots = (uint64_t)((rows + CHUNK_MASK) >> CHUNK_SHIFT) * ((cols + CHUNK_MASK) >> CHUNK_SHIFT);
+    uint64_t rooms = roomCount, corridors = corridorCount, tiles = (uint64_t)rows * cols;
+    if (!pointOnMap(packed->playerLocation.x, packed->playerLocation.y, rows, cols)
+        || !pointOnMap(packed->exitLocation.x, packed->exitLocation.y, rows, cols)
+        || !pointOnMap(packed->treasureLocation.x, packed->treasureLocation.y, rows, cols)
+        || !packSectionFits(pack, packed->chunkSlots, slots * sizeof(uint64_t))
+        || !packSectionFits(pack, packed->roomFields, 5 * rooms * sizeof(uint16_t))
+        || !packSectionFits(pack, packed->roomOfQuadrant, cells * sizeof(int32_t))
+        || !packSectionFits(pack, packed->corridors, corridors * sizeof(struct PackedCorridor))
+        || !packSectionFits(pack, packed->corridorRuns, (uint64_t)packed->corridorRunCount * sizeof(struct CorridorRun))
+        || !packSectionFits(pack, packed->corridorEnds, 2 * corridors * sizeof(struct PackedCorridorEnd))
+        || !packSectionFits(pack, packed->doors, 2 * corridors * sizeof(struct PackedPoint))
+        || !packSectionFits(pack, packed->graphOffsets, (rooms + 1) * sizeof(int32_t))
+        || !packSectionFits(pack, packed->graphNeighbors, 2 * corridors * sizeof(uint16_t))
+        || !packSectionFits(pack, packed->connectionsCount, rooms * sizeof(int32_t))
+        || !packSectionFits(pack, packed->exitDistances, tiles * sizeof(uint16_t))
+        || !packSectionFits(pack, packed->treasureDistances, tiles * sizeof(uint16_t))) {
+        return 0;
+    }
+    const uint64_t *chunkOffsets = (const uint64_t *)(pack->base + packed->chunkSlots);
+    for (uint64_t i = 0; i < slots; i++) {
+        if (chunkOffsets[i] != 0 && !packSectionFits(pack, chunkOffsets[i], CHUNK_SIZE * CHUNK_SIZE / 2)) {
+            return 0;
+        }
+    }
+
+    // every room lies on the map, in a cell of the grid
+    const uint16_t *roomFields = (const uint16_t *)(pack->base + packed->roomFields);
+    for (int i = 0; i < roomCount; i++) {
+        int x = roomFields[i], y = roomFields[roomCount + i];
+        int width = roomFields[2 * roomCount + i], height = roomFields[3 * roomCount + i];
+        if (x + width > cols || y + height > rows || roomFields[4 * roomCount + i] >= cells) {
+            return 0;
+        }
+    }
+    const int32_t *roomOfQuadrant = (const int32_t *)(pack->base + packed->roomOfQuadrant);
+    for (int64_t i = 0; i < cells; i++) {
+        if (roomOfQuadrant[i] < -1 || roomOfQuadrant[i] >= roomCount) {
+            return 0;
+        }
+    }
+    // every corridor's runs are in the pool and walk from a tile on the map to
+    // another one without leaving it; a run is straight, so checking its end is enough
+    const struct PackedCorridor *packedCorridors = (const struct PackedCorridor *)(pack->base + packed->corridors);
+    const struct CorridorRun *runs = (const struct CorridorRun *)(pack->base + packed->corridorRuns);
+    for (int i = 0; i < corridorCount; i++) {
+        const struct PackedCorridor *c = &packedCorridors[i];
+        if (c->firstRun < 0 || c->runCount < 0 || c->firstRun > packed->corridorRunCount - c->runCount
+            || c->rooms[0] < 0 || c->rooms[0] >= roomCount || c->rooms[1] < 0 || c->rooms[1] >= roomCount
+            || !pointOnMap(c->startX, c->startY, rows, cols)) {
+            return 0;
+        }
+        int x = c->startX, y = c->startY;
+        for (int r = c->firstRun; r < c->firstRun + c->runCount; r++) {
+            if (runs[r].direction > 3) {
+                return 0;
+            }
+            x += wallStepX[runs[r].direction] * runs[r].length;
+            y += wallStepY[runs[r].direction] * runs[r].length;
+            if (!pointOnMap(x, y, rows, cols)) {
+                return 0;
+            }
+        }
+    }
+    const struct PackedCorridorEnd *ends = (const struct PackedCorridorEnd *)(pack->base + packed->corridorEnds);
+    const struct PackedPoint *doors = (const struct PackedPoint *)(pack->base + packed->doors);
+    for (int i = 0; i < 2 * corridorCount; i++) {
+        if (!pointOnMap(ends[i].x, ends[i].y, rows, cols) || ends[i].room < 0 || ends[i].room >= roomCount
+            || ends[i].wall < 0 || ends[i].wall > 3 || !pointOnMap(doors[i].x, doors[i].y, rows, cols)) {
+            return 0;
+        }
+    }
+    // the room graph's offsets climb from 0 and stay inside its neighbor list
+    const int32_t *graphOffsets = (const int32_t *)(pack->base + packed->graphOffsets);
+    const uint16_t *graphNeighbors = (const uint16_t *)(pack->base + packed->graphNeighbors);
+    if (graphOffsets[0] != 0 || graphOffsets[roomCount] > 2 * corridorCount) {
+        return 0;
+    }
+    for (int i = 0; i < roomCount; i++) {
+        if (graphOffsets[i + 1] < graphOffsets[i]) {
+            return 0;
+        }
+    }
+    for (int i = 0; i < graphOffsets[roomCount]; i++) {
+        if (graphNeighbors[i] >= roomCount) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Opens a level of a pack in place.
+ *
+ * Nothing is parsed or copied: the level's rooms, corridors, doors, room graph
+ * and distance fields point into the mapped pack, and so do its map chunks. The only
+ * allocation is the map's table of chunk pointers. Release the level with
+ * freeLevel, and close the pack only after every level opened from it.
+ *
+ * @param pack The open pack.
+ * @param index The level's index in the pack, see findPackedLevel.
+ * @param out The level to fill in.
+ * @return 1 on success, 0 if the level runs past the end of the pack, is corrupt, or memory could
+ *         not be allocated.
+ */
+int loadPackedLevel(const struct LevelPack *pack, int index, struct Level *out) {
+    unsigned char *base = pack->base;
+    uint64_t offset = pack->index[index].offset;
+    // checked before the cast, which needs the header to be aligned
+    if (!packSectionFits(pack, offset, sizeof(struct PackedLevel))
+        || !packedLevelFits(pack, (const struct PackedLevel *)(base + offset))) {
+        printf("Error: level %d of the pack is truncated or corrupt\n", index);
+        return 0;
+    }
+    const struct PackedLevel *packed = (const struct PackedLevel *)(base + offset);
+
+    if (!initTileMap(&out->tiles, packed->gridRows * CELL_ROWS, packed->gridCols * CELL_COLS)) {
+        return 0;
+    }
+    const uint64_t *chunkOffsets = (const uint64_t *)(base + packed->chunkSlots);
+    for (int i = 0; i < out->tiles.chunkRows * out->tiles.chunkCols; i++) {
+        out->tiles.chunks[i] = chunkOffsets[i] ? base + chunkOffsets[i] : NULL;
+    }
+    out->tiles.allocatedChunks = packed->allocatedChunks;
+
+    int roomCount = packed->roomCount;
+    out->rooms.count = roomCount;
+    out->rooms.gridCols = packed->gridCols;
+    out->rooms.cells = packed->gridCols * packed->gridRows;
+    out->rooms.x = (uint16_t *)(base + packed->roomFields);
+    out->rooms.y = out->rooms.x + roomCount;
+    out->rooms.width = out->rooms.y + roomCount;
+    out->rooms.height = out->rooms.width + roomCount;
+    out->rooms.quadrant = out->rooms.height + roomCount;
+    out->rooms.roomOfQuadrant = (int *)(base + packed->roomOfQuadrant);
+
+    out->corridors = (struct Corridor *)(base + packed->corridors);
+    out->corridorRuns = (struct CorridorRun *)(base + packed->corridorRuns);
+    out->corridorRunCount = packed->corridorRunCount;
+    out->corridorEnds = (struct CorridorEnd *)(base + packed->corridorEnds);
+    out->doors = (struct Point *)(base + packed->doors);
+    out->corridorCount = packed->corridorCount;
+    out->connections.numRooms = roomCount;
+    out->connections.offsets = (int *)(base + packed->graphOffsets);
+    out->connections.neighbors = (uint16_t *)(base + packed->graphNeighbors);
+    out->connectionsCount = (int *)(base + packed->connectionsCount);
+    out->exitDistances = (uint16_t *)(base + packed->exitDistances);
+    out->treasureDistances = (uint16_t *)(base + packed->treasureDistances);
+    out->roomCount = roomCount;
+    out->startRoomIndex = packed->startRoomIndex;
+    out->exitRoomIndex = packed->exitRoomIndex;
+    out->treasureRoomIndex = packed->treasureRoomIndex;
+    out->playerLocation = (struct Point) {packed->playerLocation.x, packed->playerLocation.y};
+    out->exitLocation = (struct Point) {packed->exitLocation.x, packed->exitLocation.y};
+    out->treasureLocation = (struct Point) {packed->treasureLocation.x, packed->treasureLocation.y};
+    out->pack = pack;
+    return 1;
+}
+
+
+/*
+A bounded cache of generated levels, so replaying a seed (a daily challenge, a
+shared fav seed, a retry) doesn't run the generator again. Games never write to
+their level, so every game on a seed shares the cached one; a game only holds a
+reference to it. Levels are kept in least-recently-used order and the oldest
+level no game is playing is the one evicted. The cache only grows past its
+capacity while every level in it is being played, and shrinks back as soon as
+those games give their levels back. A cache is not thread-safe, give
+each thread its own.
+*/
+struct CachedLevel {
+    struct Level level;
+    struct LevelCache *cache; // the cache it belongs to
+    uint64_t seed; // the key: seed and grid size, which decide everything else about a level
+    int gridCols;
+    int gridRows;
+    int references; // games playing it, it can't be evicted while this is above 0
+    struct CachedLevel *newer; // towards the most recently used end of the list
+    struct CachedLevel *older;
+    struct CachedLevel *nextInBucket; // the next entry with the same hash
+};
+
+struct LevelCache {
+    int capacity; // levels kept, exceeded only while every level is being played
+    int count;
+    int bucketCount; // a power of two
+    struct CachedLevel **buckets;
+    struct CachedLevel *newest;
+    struct CachedLevel *oldest;
+    long hits; // acquireLevel calls answered from the cache
+    long misses; // acquireLevel calls that had to generate
+    long evictions;
+};
+
+/**
+ * Sets up an empty cache.
+ *
+ * @param cache The cache to initialize, release it with freeLevelCache.
+ * @param capacity The most levels to keep, at least 1.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int initLevelCache(struct LevelCache *cache, int capacity) {
+    memset(cache, 0, sizeof(*cache));
+    cache->capacity = capacity;
+    cache->bucketCount = 1;
+    while (cache->bucketCount < 2 * capacity) {
+        cache->bucketCount <<= 1;
+    }
+    cache->buckets = calloc(cache->bucketCount, sizeof(struct CachedLevel *));
+    return cache->buckets != NULL;
+}
+
+// Returns the bucket a key hashes to
+struct CachedLevel **cacheBucket(struct LevelCache *cache, uint64_t seed, int gridCols, int gridRows) {
+    uint64_t hash = seed ^ ((uint64_t)gridCols << 32 | (uint32_t)gridRows);
+    return &cache->buckets[splitmix64(&hash) & (cache->bucketCount - 1)];
+}
+
+void unlinkCachedLevel(struct LevelCache *cache, struct CachedLevel *entry) {
+    *(entry->newer ? &entry->newer->older : &cache->newest) = entry->older;
+    *(entry->older ? &entry->older->newer : &cache->oldest) = entry->newer;
+}
+
+void linkNewestLevel(struct LevelCache *cache, struct CachedLevel *entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    *(cache->newest ? &cache->newest->newer : &cache->oldest) = entry;
+    cache->newest = entry;
+}
+
+// Removes a level nobody is playing from the cache and frees it
+void evictLevel(struct LevelCache *cache, struct CachedLevel *entry) {
+    struct CachedLevel **link = cacheBucket(cache, entry->seed, entry->gridCols, entry->gridRows);
+    while (*link != entry) {
+        link = &(*link)->nextInBucket;
+    }
+    *link = entry->nextInBucket;
+    unlinkCachedLevel(cache, entry);
+    freeLevel(&entry->level);
+    free(entry);
+    cache->count--;
+    cache->evictions++;
+}
+
+// Drops the least recently used levels nobody is playing until the cache is back to capacity
+void evictLevels(struct LevelCache *cache) {
+    struct CachedLevel *entry = cache->oldest;
+    while (cache->count > cache->capacity && entry != NULL) {
+        struct CachedLevel *newer = entry->newer;
+        if (entry->references == 0) {
+            evictLevel(cache, entry);
+        }
+        entry = newer;
+    }
+}
+
+/**
+ * Hands out the level for a seed, generating it only if it isn't cached.
+ *
+ * The level is shared, not copied: it must not be written to, and it stays
+ * valid until it is given back with releaseLevel.
+ *
+ * @param cache The cache.
+ * @param gen The generator to build the level with on a miss, its grid is part of the key.
+ * @param seed The level's seed.
+ * @return The cached level, or NULL if memory could not be allocated.
+ */
+struct CachedLevel *acquireLevel(struct LevelCache *cache, struct Generator *gen, uint64_t seed) {
+    struct CachedLevel **bucket = cacheBucket(cache, seed, gen->gridCols, gen->gridRows);
+    for (struct CachedLevel *entry = *bucket; entry != NULL; entry = entry->nextInBucket) {
+        if (entry->seed == seed && entry->gridCols == gen->gridCols && entry->gridRows == gen->gridRows) {
+            cache->hits++;
+            unlinkCachedLevel(cache, entry);
+            linkNewestLevel(cache, entry);
+            entry->references++;
+            return entry;
+        }
+    }
+
+    cache->misses++;
+    struct CachedLevel *entry = malloc(sizeof(struct CachedLevel));
+    if (entry == NULL || !generateLevel(gen, seed, &entry->level)) {
+        free(entry);
+        return NULL;
+    }
+    // a cached level is played again and again, so it carries its distance fields
+    if (!buildDistanceFields(gen, &entry->level)) {
+        freeLevel(&entry->level);
+        free(entry);
+        return NULL;
+    }
+    entry->cache = cache;
+    entry->seed = seed;
+    entry->gridCols = gen->gridCols;
+    entry->gridRows = gen->gridRows;
+    entry->references = 1;
+    entry->nextInBucket = *bucket;
+    *bucket = entry;
+    linkNewestLevel(cache, entry);
+    cache->count++;
+    evictLevels(cache);
+    return entry;
+}
+
+// Gives back a level from acquireLevel. It stays cached unless the cache is over
+// capacity, which only happens while every other level is being played too.
+void releaseLevel(struct CachedLevel *entry) {
+    if (--entry->references == 0 && entry->cache->count > entry->cache->capacity) {
+        evictLevel(entry->cache, entry);
+    }
+}
+
+// Frees every cached level, none of which may still be in play
+void freeLevelCache(struct LevelCache *cache) {
+    while (cache->oldest != NULL) {
+        struct CachedLevel *entry = cache->oldest;
+        unlinkCachedLevel(cache, entry);
+        freeLevel(&entry->level);
+        free(entry);
+    }
+    free(cache->buckets);
+    cache->buckets = NULL;
+    cache->count = 0;
+}
+
+
+/*
+Pathfinding over a level's passable tiles (the ones with TILE_PASSABLE), moving
+one tile north, east, south or west at a time like the player does.
+
+A PathFinder takes a snapshot of which tiles are passable, padded with a border
+of blocked tiles so no search ever needs a bounds check, and keeps its search
+arrays between queries. A query never clears them: it bumps query and treats
+any node whose seen stamp is older as unvisited.
+
+findPath runs A*, or jump point search when asked. Jump point search adapted to
+four directions treats vertical moves the way the 8-way version treats diagonals:
+a vertical jump looks along the row at every tile it passes, while a horizontal
+jump only stops at the goal or where a tile above or below opens up beside a
+blocked one. Across open room floors it pushes a handful of nodes where A*
+pushes every tile.
+*/
+// A binary min-heap of 64-bit entries, ordered by the whole value, so a search
+// puts the priority in the high half and what it refers to in the low half
+struct MinHeap {
+    uint64_t *entries;
+    int count;
+    int capacity;
+};
+
+int initMinHeap(struct MinHeap *heap, int capacity) {
+    heap->count = 0;
+    heap->capacity = capacity;
+    heap->entries = malloc(capacity * sizeof(uint64_t));
+    return heap->entries != NULL;
+}
+
+void freeMinHeap(struct MinHeap *heap) {
+    free(heap->entries);
+    heap->entries = NULL;
+}
+
+// Returns 1 once entry is queued, or 0 if the heap could not grow to take it
+int heapPush(struct MinHeap *heap, uint64_t entry) {
+    if (heap->count == heap->capacity) {
+        uint64_t *grown = realloc(heap->entries, 2 * heap->capacity * sizeof(uint64_t));
+        if (grown == NULL) {
+            return 0;
+        }
+        heap->entries = grown;
+        heap->capacity *= 2;
+    }
+    int i = heap->count++;
+    while (i > 0 && heap->entries[(i - 1) / 2] > entry) {
+        heap->entries[i] = heap->entries[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap->entries[i] = entry;
+    return 1;
+}
+
+uint64_t heapPop(struct MinHeap *heap) {
+    uint64_t top = heap->entries[0];
+    uint64_t last = heap->entries[--heap->count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && heap->entries[child + 1] < heap->entries[child]) {
+            child++;
+        }
+        if (heap->entries[child] >= last) {
+            break;
+        }
+        heap->entries[i] = heap->entries[child];
+        i = child;
+    }
+    heap->entries[i] = last;
+    return top;
+}
+
+struct PathFinder {
+    int rows;
+    int cols;
+    int stride; // cols + 2, a node is (y + 1) * stride + x + 1
+    unsigned char *open; // 1 where passable, (rows + 2) * stride entries
+    int *cost; // steps from the start along the best path found so far
+    int *parent; // the node that path came from, -1 for the start
+    uint32_t *seen; // the query cost and parent were last set in
+    uint32_t query;
+    struct MinHeap heap; // open list entries, estimated total cost in the high half and node in the low
+    int goal; // the current query's goal node
+    long pushed; // heap pushes over every query, to compare the searches
+};
+
+/**
+ * Sets up a path finder for a level.
+ *
+ * @param finder The finder to initialize, release it with freePathFinder.
+ * @param level The level; the finder keeps a copy of which tiles are passable.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int initPathFinder(struct PathFinder *finder, const struct Level *level) {
+    const struct TileMap *map = &level->tiles;
+    size_t nodes = (size_t)(map->rows + 2) * (map->cols + 2);
+    memset(finder, 0, sizeof(*finder));
+    finder->rows = map->rows;
+    finder->cols = map->cols;
+    finder->stride = map->cols + 2;
+    finder->open = calloc(nodes, 1);
+    finder->cost = malloc(nodes * sizeof(int));
+    finder->parent = malloc(nodes * sizeof(int));
+    finder->seen = calloc(nodes, sizeof(uint32_t));
+    if (!initMinHeap(&finder->heap, 1024) || finder->open == NULL || finder->cost == NULL
+        || finder->parent == NULL || finder->seen == NULL) {
+        return 0;
+    }
+    for (int y = 0; y < map->rows; y++) {
+        for (int x = 0; x < map->cols; x++) {
+            finder->open[(y + 1) * finder->stride + x + 1] = tileProperties[getTile(map, x, y)] & TILE_PASSABLE;
+        }
+    }
+    return 1;
+}
+
+void freePathFinder(struct PathFinder *finder) {
+    free(finder->open);
+    free(finder->cost);
+    free(finder->parent);
+    free(finder->seen);
+    freeMinHeap(&finder->heap);
+    finder->open = NULL;
+    finder->cost = NULL;
+    finder->parent = NULL;
+    finder->seen = NULL;
+}
+
+// Returns the Manhattan distance between two nodes, the search's heuristic
+int nodeDistance(const struct PathFinder *finder, int a, int b) {
+    return abs(a % finder->stride - b % finder->stride) + abs(a / finder->stride - b / finder->stride);
+}
+
+// Records a path to node through from if it is the best yet, and queues node;
+// returns 0 if the heap ran out of memory, 1 otherwise
+int relaxNode(struct PathFinder *finder, int node, int from, int cost) {
+    if (finder->seen[node] == finder->query && finder->cost[node] <= cost) {
+        return 1;
+    }
+    finder->seen[node] = finder->query;
+    finder->cost[node] = cost;
+    finder->parent[node] = from;
+    finder->pushed++;
+    return heapPush(&finder->heap, (uint64_t)(cost + nodeDistance(finder, node, finder->goal)) << 32 | (uint32_t)node);
+}
+
+// Jumps along a row from node, step is 1 or -1; returns the jump point reached or -1
+int jumpHorizontal(const struct PathFinder *finder, int node, int step) {
+    const unsigned char *open = finder->open;
+    int stride = finder->stride;
+    for (;;) {
+        node += step;
+        if (!open[node]) {
+            return -1;
+        }
+        if (node == finder->goal
+            || (open[node - stride] && !open[node - step - stride])
+            || (open[node + stride] && !open[node - step + stride])) {
+            return node;
+        }
+    }
+}
+
+// Jumps along a column from node, step is stride or -stride; returns the jump point reached or -1
+int jumpVertical(const struct PathFinder *finder, int node, int step) {
+    for (;;) {
+        node += step;
+        if (!finder->open[node]) {
+            return -1;
+        }
+        if (node == finder->goal || jumpHorizontal(finder, node, 1) >= 0 || jumpHorizontal(finder, node, -1) >= 0) {
+            return node;
+        }
+    }
+}
+
+// Queues the jump points a node leads to, given the direction it was reached from;
+// returns 0 if the heap ran out of memory, 1 otherwise
+int expandJumpPoints(struct PathFinder *finder, int node) {
+    int stride = finder->stride;
+    int parent = finder->parent[node];
+    int jumps[4];
+    int count = 0;
+    if (parent < 0) {
+        // the start looks every way
+        jumps[count++] = jumpHorizontal(finder, node, 1);
+        jumps[count++] = jumpHorizontal(finder, node, -1);
+        jumps[count++] = jumpVertical(finder, node, stride);
+        jumps[count++] = jumpVertical(finder, node, -stride);
+    } else if (parent / stride == node / stride) {
+        // along a row: keep going, and turn only into the openings the row made
+        int step = node > parent ? 1 : -1;
+        jumps[count++] = jumpHorizontal(finder, node, step);
+        if (finder->open[node - stride] && !finder->open[node - step - stride]) {
+            jumps[count++] = jumpVertical(finder, node, -stride);
+        }
+        if (finder->open[node + stride] && !finder->open[node - step + stride]) {
+            jumps[count++] = jumpVertical(finder, node, stride);
+        }
+    } else {
+        // along a column: keep going, and look both ways along the row
+        jumps[count++] = jumpVertical(finder, node, node > parent ? stride : -stride);
+        jumps[count++] = jumpHorizontal(finder, node, 1);
+        jumps[count++] = jumpHorizontal(finder, node, -1);
+    }
+    for (int i = 0; i < count; i++) {
+        if (jumps[i] >= 0 && !relaxNode(finder, jumps[i], node, finder->cost[node] + nodeDistance(finder, node, jumps[i]))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Finds a shortest path between two tiles.
+ *
+ * @param finder The path finder for the level.
+ * @param start The tile to start from.
+ * @param goal The tile to reach.
+ * @param jump 1 for jump point search, 0 for plain A*; both find paths of the same length.
+ * @param path Filled in with the tiles of the path after start, up to goal, if not NULL.
+ * @param capacity The most tiles path can take; a longer path still has its length returned.
+ * @return The number of steps in the path, -1 if either tile is impassable or goal can't be reached,
+ *         or -2 if the search ran out of memory.
+ */
+int findPath(struct PathFinder *finder, struct Point start, struct Point goal, int jump,
+             struct Point *path, int capacity) {
+    int stride = finder->stride;
+    int first = (start.y + 1) * stride + start.x + 1;
+    finder->goal = (goal.y + 1) * stride + goal.x + 1;
+    if (!finder->open[first] || !finder->open[finder->goal]) {
+        return -1;
+    }
+    if (++finder->query == 0) {
+        // the stamps wrapped around, so old ones could look current
+        memset(finder->seen, 0, (size_t)(finder->rows + 2) * stride * sizeof(uint32_t));
+        finder->query = 1;
+    }
+    finder->heap.count = 0;
+    if (!relaxNode(finder, first, -1, 0)) {
+        return -2;
+    }
+
+    int found = 0;
+    while (finder->heap.count > 0) {
+        uint64_t entry = heapPop(&finder->heap);
+        int node = (uint32_t)entry;
+        if ((int)(entry >> 32) != finder->cost[node] + nodeDistance(finder, node, finder->goal)) {
+            continue; // a better path to it was queued since
+        }
+        if (node == finder->goal) {
+            found = 1;
+            break;
+        }
+        if (jump) {
+            if (!expandJumpPoints(finder, node)) {
+                return -2;
+            }
+        } else {
+            const int steps[4] = {-stride, 1, stride, -1};
+            for (int i = 0; i < 4; i++) {
+                if (finder->open[node + steps[i]] && !relaxNode(finder, node + steps[i], node, finder->cost[node] + 1)) {
+                    return -2;
+                }
+            }
+        }
+    }
+    if (!found) {
+        return -1;
+    }
+
+    // walk back from the goal, filling in the straight runs between jump points
+    int length = finder->cost[finder->goal];
+    for (int node = finder->goal; node != first && path != NULL; node = finder->parent[node]) {
+        int parent = finder->parent[node];
+        int step = parent / stride == node / stride ? (node > parent ? 1 : -1) : (node > parent ? stride : -stride);
+        for (int tile = node; tile != parent; tile -= step) {
+            int index = finder->cost[node] - nodeDistance(finder, tile, node) - 1;
+            if (index < capacity) {
+                path[index] = (struct Point) {tile % stride - 1, tile / stride - 1};
+            }
+        }
+    }
+    return length;
+}
+
+
+/*
+Hierarchical routes: long paths are searched over the level's doors instead of
+its tiles. Every door tile is a node, and two doors are joined when one can be
+reached from the other without passing through a third: along a corridor (its
+length) or across a room (the door-to-door cost). Those costs are measured once
+by a breadth-first flood from each door that stops at the doors it meets.
+
+A query floods only the start's and the goal's own room or corridor out to
+their doors, then runs A* over the door graph, which has a few nodes per room
+however large the map is. No door link is shorter than the straight-line
+Manhattan distance between its doors, so that distance stays a sound estimate.
+Any path splits into pieces at the doors it passes, and no piece is shorter
+than the cost measured for it, so routes are as short as the ones a full tile
+search finds.
+*/
+struct RoomRoutes {
+    int stride; // cols + 2, tiles are numbered as in PathFinder
+    int tiles; // (rows + 2) * stride
+    unsigned char *open; // 1 where passable, the border blocked
+    int *doorNode; // the door node on each tile, -1 for tiles that aren't doors
+    int nodeCount;
+    int *nodeTile; // the tile each door node is on
+    int *edgeOffsets; // node i's edges are edgeTarget/edgeCost[edgeOffsets[i]] up to edgeOffsets[i + 1]
+    int *edgeTarget;
+    int *edgeCost; // steps between the two doors
+    // search scratch, kept between queries and stamped instead of cleared
+    uint32_t flood;
+    uint32_t *tileSeen; // the flood that last reached each tile
+    int *tileCost; // steps from where that flood started
+    int *queue; // one entry per tile
+    uint32_t query;
+    uint32_t *nodeSeen; // the query that last set nodeCost and nodeParent
+    uint32_t *goalSeen; // the query that last set goalCost
+    int *nodeCost; // steps from the start
+    int *nodeParent; // the node the best route came through, -1 straight from the start
+    int *goalCost; // steps to the goal, for the doors around it
+    int *floodNodes; // the doors a flood met and their costs, nodeCount of each
+    int *floodCosts;
+    int goalTile; // the current query's goal
+    struct MinHeap heap; // estimated total cost in the high half, node in the low
+};
+
+/**
+ * Floods from a tile without passing through doors, and reports the doors it meets.
+ *
+ * @param routes The routes.
+ * @param from The tile to start from; if it is a door itself, it is reported at 0 steps.
+ * @param target A tile to look out for, or -1.
+ * @param targetCost Set to the steps to target, or -1 if the flood didn't reach it.
+ * @return The number of doors met, which are left in floodNodes and floodCosts.
+ */
+int floodToDoors(struct RoomRoutes *routes, int from, int target, int *targetCost) {
+    const int steps[4] = {-routes->stride, 1, routes->stride, -1};
+    if (++routes->flood == 0) {
+        memset(routes->tileSeen, 0, routes->tiles * sizeof(uint32_t));
+        routes->flood = 1;
+    }
+    uint32_t flood = routes->flood;
+    int count = 0;
+    int head = 0, tail = 0;
+    routes->queue[tail++] = from;
+    routes->tileSeen[from] = flood;
+    routes->tileCost[from] = 0;
+    *targetCost = from == target ? 0 : -1;
+    while (head < tail) {
+        int tile = routes->queue[head++];
+        int node = routes->doorNode[tile];
+        if (node >= 0) {
+            routes->floodNodes[count] = node;
+            routes->floodCosts[count++] = routes->tileCost[tile];
+            if (tile != from) {
+                continue; // the flood stops at doors
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            int next = tile + steps[i];
+            if (routes->open[next] && routes->tileSeen[next] != flood) {
+                routes->tileSeen[next] = flood;
+                routes->tileCost[next] = routes->tileCost[tile] + 1;
+                routes->queue[tail++] = next;
+                if (next == target) {
+                    *targetCost = routes->tileCost[next];
+                }
+            }
+        }
+    }
+    return count;
+}
+
+void freeRoomRoutes(struct RoomRoutes *routes) {
+    free(routes->open);
+    free(routes->doorNode);
+    free(routes->nodeTile);
+    free(routes->edgeOffsets);
+    free(routes->edgeTarget);
+    free(routes->edgeCost);
+    free(routes->tileSeen);
+    free(routes->tileCost);
+    free(routes->queue);
+    free(routes->nodeSeen);
+    free(routes->goalSeen);
+    free(routes->nodeCost);
+    free(routes->nodeParent);
+    free(routes->goalCost);
+    free(routes->floodNodes);
+    free(routes->floodCosts);
+    freeMinHeap(&routes->heap);
+    memset(routes, 0, sizeof(*routes));
+}
+
+/**
+ * Builds the door graph of a level and measures every door-to-door cost.
+ *
+ * @param routes The routes to initialize, release them with freeRoomRoutes.
+ * @param level The level; the routes keep their own copy of what they need.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int initRoomRoutes(struct RoomRoutes *routes, const struct Level *level) {
+    const struct TileMap *map = &level->tiles;
+    int doors = 2 * level->corridorCount;
+    memset(routes, 0, sizeof(*routes));
+    routes->stride = map->cols + 2;
+    routes->tiles = (map->rows + 2) * routes->stride;
+    routes->open = calloc(routes->tiles, 1);
+    routes->doorNode = malloc(routes->tiles * sizeof(int));
+    routes->tileSeen = calloc(routes->tiles, sizeof(uint32_t));
+    routes->tileCost = malloc(routes->tiles * sizeof(int));
+    routes->queue = malloc(routes->tiles * sizeof(int));
+    routes->nodeTile = malloc(doors * sizeof(int));
+    routes->nodeSeen = calloc(doors, sizeof(uint32_t));
+    routes->goalSeen = calloc(doors, sizeof(uint32_t));
+    routes->nodeCost = malloc(doors * sizeof(int));
+    routes->nodeParent = malloc(doors * sizeof(int));
+    routes->goalCost = malloc(doors * sizeof(int));
+    routes->floodNodes = malloc(doors * sizeof(int));
+    routes->floodCosts = malloc(doors * sizeof(int));
+    routes->edgeOffsets = malloc((doors + 1) * sizeof(int));
+    if (!initMinHeap(&routes->heap, 64) || routes->open == NULL || routes->doorNode == NULL
+        || routes->tileSeen == NULL || routes->tileCost == NULL || routes->queue == NULL
+        || routes->nodeTile == NULL || routes->nodeSeen == NULL || routes->goalSeen == NULL
+        || routes->nodeCost == NULL || routes->nodeParent == NULL || routes->goalCost == NULL
+        || routes->floodNodes == NULL || routes->floodCosts == NULL || routes->edgeOffsets == NULL) {
+        freeRoomRoutes(routes);
+        return 0;
+    }
+    for (int y = 0; y < map->rows; y++) {
+        for (int x = 0; x < map->cols; x++) {
+            routes->open[(y + 1) * routes->stride + x + 1] = tileProperties[getTile(map, x, y)] & TILE_PASSABLE;
+        }
+    }
+    // one node per door tile, in case two corridors ever share a door
+    for (int tile = 0; tile < routes->tiles; tile++) {
+        routes->doorNode[tile] = -1;
+    }
+    for (int i = 0; i < doors; i++) {
+        int tile = (level->doors[i].y + 1) * routes->stride + level->doors[i].x + 1;
+        if (routes->doorNode[tile] < 0) {
+            routes->doorNode[tile] = routes->nodeCount;
+            routes->nodeTile[routes->nodeCount++] = tile;
+        }
+    }
+
+    // flood out of every door, both into its room and along its corridor
+    int capacity = 4 * routes->nodeCount + 4;
+    routes->edgeTarget = malloc(capacity * sizeof(int));
+    routes->edgeCost = malloc(capacity * sizeof(int));
+    if (routes->edgeTarget == NULL || routes->edgeCost == NULL) {
+        freeRoomRoutes(routes);
+        return 0;
+    }
+    int edges = 0;
+    for (int node = 0; node < routes->nodeCount; node++) {
+        routes->edgeOffsets[node] = edges;
+        int unused;
+        int met = floodToDoors(routes, routes->nodeTile[node], -1, &unused);
+        if (edges + met > capacity) {
+            capacity = 2 * (edges + met);
+            int *targets = realloc(routes->edgeTarget, capacity * sizeof(int));
+            if (targets != NULL) {
+                routes->edgeTarget = targets;
+            }
+            int *costs = realloc(routes->edgeCost, capacity * sizeof(int));
+            if (costs != NULL) {
+                routes->edgeCost = costs;
+            }
+            if (targets == NULL || costs == NULL) {
+                freeRoomRoutes(routes);
+                return 0;
+            }
+        }
+        for (int i = 0; i < met; i++) {
+            if (routes->floodNodes[i] != node) {
+                routes->edgeTarget[edges] = routes->floodNodes[i];
+                routes->edgeCost[edges++] = routes->floodCosts[i];
+            }
+        }
+    }
+    routes->edgeOffsets[routes->nodeCount] = edges;
+    return 1;
+}
+
+// Returns the Manhattan distance from a door node to the goal, which no route beats
+int routeEstimate(const struct RoomRoutes *routes, int node) {
+    int tile = routes->nodeTile[node], goal = routes->goalTile;
+    return abs(tile % routes->stride - goal % routes->stride) + abs(tile / routes->stride - goal / routes->stride);
+}
+
+// Records a route to a door node if it is the best yet, and queues the node;
+// returns 0 if the heap ran out of memory, 1 otherwise
+int relaxRouteNode(struct RoomRoutes *routes, int node, int from, int cost) {
+    if (routes->nodeSeen[node] == routes->query && routes->nodeCost[node] <= cost) {
+        return 1;
+    }
+    routes->nodeSeen[node] = routes->query;
+    routes->nodeCost[node] = cost;
+    routes->nodeParent[node] = from;
+    return heapPush(&routes->heap, (uint64_t)(cost + routeEstimate(routes, node)) << 32 | (uint32_t)node);
+}
+
+/**
+ * Finds a shortest route between two tiles over the door graph.
+ *
+ * Only the start's and goal's own room or corridor are searched tile by tile.
+ * The route comes back as waypoints: the doors it passes through, then the
+ * goal. Each leg stays inside one room or corridor, so walking it with
+ * findPath is a short search.
+ *
+ * @param routes The routes for the level.
+ * @param start The tile to start from.
+ * @param goal The tile to reach.
+ * @param waypoints Filled in with the route's doors and then goal, if not NULL.
+ * @param capacity The most waypoints it can take.
+ * @param waypointCount Set to the number of waypoints on the route, which may be more than capacity.
+ * @return The number of steps on the route, -1 if either tile is impassable or goal can't be reached,
+ *         or -2 if the search ran out of memory.
+ */
+int findRoute(struct RoomRoutes *routes, struct Point start, struct Point goal,
+              struct Point *waypoints, int capacity, int *waypointCount) {
+    int stride = routes->stride;
+    int from = (start.y + 1) * stride + start.x + 1;
+    int to = (goal.y + 1) * stride + goal.x + 1;
+    *waypointCount = 0;
+    if (!routes->open[from] || !routes->open[to]) {
+        return -1;
+    }
+    if (++routes->query == 0) {
+        memset(routes->nodeSeen, 0, routes->nodeCount * sizeof(uint32_t));
+        memset(routes->goalSeen, 0, routes->nodeCount * sizeof(uint32_t));
+        routes->query = 1;
+    }
+
+    // the doors around the goal, and the direct way if the start shares its room or corridor
+    int best;
+    routes->goalTile = to;
+    int met = floodToDoors(routes, to, from, &best);
+    for (int i = 0; i < met; i++) {
+        routes->goalSeen[routes->floodNodes[i]] = routes->query;
+        routes->goalCost[routes->floodNodes[i]] = routes->floodCosts[i];
+    }
+    int unused;
+    met = floodToDoors(routes, from, -1, &unused);
+    routes->heap.count = 0;
+    for (int i = 0; i < met; i++) {
+        if (!relaxRouteNode(routes, routes->floodNodes[i], -1, routes->floodCosts[i])) {
+            return -2;
+        }
+    }
+
+    int bestNode = -1; // the last door before the goal, -1 for the direct way
+    while (routes->heap.count > 0) {
+        uint64_t entry = heapPop(&routes->heap);
+        int node = (uint32_t)entry;
+        int cost = routes->nodeCost[node];
+        if ((int)(entry >> 32) != cost + routeEstimate(routes, node)) {
+            continue; // a cheaper route to it was queued since
+        }
+        if (best >= 0 && (int)(entry >> 32) >= best) {
+            break; // nothing left can beat the best route
+        }
+        if (routes->goalSeen[node] == routes->query && (best < 0 || cost + routes->goalCost[node] < best)) {
+            best = cost + routes->goalCost[node];
+            bestNode = node;
+        }
+        for (int edge = routes->edgeOffsets[node]; edge < routes->edgeOffsets[node + 1]; edge++) {
+            if (!relaxRouteNode(routes, routes->edgeTarget[edge], node, cost + routes->edgeCost[edge])) {
+                return -2;
+            }
+        }
+    }
+    if (best < 0) {
+        return -1;
+    }
+
+    // count the doors back to the start, then fill them in from the far end
+    int count = 1;
+    for (int node = bestNode; node >= 0; node = routes->nodeParent[node]) {
+        count++;
+    }
+    *waypointCount = count;
+    if (waypoints != NULL) {
+        if (count - 1 < capacity) {
+            waypoints[count - 1] = goal;
+        }
+        int index = count - 2;
+        for (int node = bestNode; node >= 0; node = routes->nodeParent[node], index--) {
+            if (index < capacity) {
+                int tile = routes->nodeTile[node];
+                waypoints[index] = (struct Point) {tile % stride - 1, tile / stride - 1};
+            }
+        }
+    }
+    return best;
+}
+
+
+// What a call to step did
+enum StepResult {
+    STEP_MOVED,
+    STEP_BLOCKED, // the action moved nowhere: a wall, blank space or a meaningless key
+    STEP_TREASURE, // moved onto the treasure and picked it up
+    STEP_WON, // moved onto the exit, the game is over
+    STEP_QUIT, // the player quit, the game is over
+    STEP_RESULT_COUNT
+};
+
+// The message the game shows after each StepResult
+const char *stepMessages[STEP_RESULT_COUNT] = {
+    "", "Invalid move", "You found the treasure!", "You win!", ""
+};
+
+/**
+ * Everything one game in progress needs: its level and where the player is.
+ *
+ * Gameplay only changes a GameState through step, which does no I/O, so the
+ * same game can be driven by a terminal, a script or a bot.
+ */
+struct GameState {
+    struct Level level;
+    struct Point playerLocation;
+    int hasTreasure;
+    int finished; // 1 once the player has won or quit
+    long moves; // moves that went somewhere
+    struct CachedLevel *cached; // the cache entry level is a view of, NULL if the game owns its level
+};
+
+/**
+ * Starts a game on a freshly generated level.
+ *
+ * @param game The game to initialize, release it with freeGame.
+ * @param gen The generator to build the level with.
+ * @param seed The level's seed.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int initGame(struct GameState *game, struct Generator *gen, uint64_t seed) {
+    if (!generateLevel(gen, seed, &game->level)) {
+        return 0;
+    }
+    game->playerLocation = game->level.playerLocation;
+    game->hasTreasure = 0;
+    game->finished = 0;
+    game->moves = 0;
+    game->cached = NULL;
+    return 1;
+}
+
+/**
+ * Starts a game on a level from a pack, without generating anything.
+ *
+ * @param game The game to initialize, release it with freeGame before closing the pack.
+ * @param pack The open pack.
+ * @param index The level's index in the pack.
+ * @return 1 on success, 0 if the level could not be opened.
+ */
+int initPackedGame(struct GameState *game, const struct LevelPack *pack, int index) {
+    if (!loadPackedLevel(pack, index, &game->level)) {
+        return 0;
+    }
+    game->playerLocation = game->level.playerLocation;
+    game->hasTreasure = 0;
+    game->finished = 0;
+    game->moves = 0;
+    game->cached = NULL;
+    return 1;
+}
+
+/**
+ * Starts a game on a level from a cache, generating it only on a miss.
+ *
+ * The game gets its own copy of the Level struct, so it can take the treasure,
+ * but the map, rooms and corridors are the cached level's.
+ *
+ * @param game The game to initialize, release it with freeGame before freeing the cache.
+ * @param cache The cache.
+ * @param gen The generator to build the level with on a miss.
+ * @param seed The level's seed.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int initCachedGame(struct GameState *game, struct LevelCache *cache, struct Generator *gen, uint64_t seed) {
+    game->cached = acquireLevel(cache, gen, seed);
+    if (game->cached == NULL) {
+        return 0;
+    }
+    game->level = game->cached->level;
+    game->playerLocation = game->level.playerLocation;
+    game->hasTreasure = 0;
+    game->finished = 0;
+    game->moves = 0;
+    return 1;
+}
+
+void freeGame(struct GameState *game) {
+    if (game->cached != NULL) {
+        releaseLevel(game->cached);
+        game->cached = NULL;
+    } else {
+        freeLevel(&game->level);
+    }
+}
+
+/**
+ * Advances a game by one action.
+ *
+ * The player is not stored in the map, so the destination tile's properties
+ * decide the whole move with a single lookup. The map is never written to, so
+ * games may share one level; taking the treasure only clears the game's own
+ * treasureLocation.
+ *
+ * @param game The game, which must not be finished yet.
+ * @param action The player's action.
+ * @return What the action did.
+ */
+enum StepResult step(struct GameState *game, enum Action action) {
+    if (action == ACTION_QUIT) {
+        game->finished = 1;
+        return STEP_QUIT;
+    }
+    struct Point destination = {game->playerLocation.x + actionStepX[action], game->playerLocation.y + actionStepY[action]};
+    int properties = tileProperties[getTile(&game->level.tiles, destination.x, destination.y)];
+    if (action == ACTION_NONE || !(properties & TILE_PASSABLE)) {
+        return STEP_BLOCKED;
+    }
+
+    game->playerLocation = destination;
+    game->moves++;
+    if (properties & TILE_IS_EXIT) {
+        game->finished = 1;
+        return STEP_WON;
+    } else if ((properties & TILE_IS_TREASURE) && !game->hasTreasure) {
+        // the treasure is picked up, glyphAt shows plain floor there from now on
+        game->hasTreasure = 1;
+        game->level.treasureLocation = (struct Point) {-1, -1};
+        return STEP_TREASURE;
+    }
+    return STEP_MOVED;
+}
+
+
+/**
+ * Draws the game screen on an ANSI terminal, sending only what changed since the last frame.
+ *
+ * The screen is the message on row 1, the map below it with a space after every
+ * glyph, and the prompt under the map. Each frame is assembled in out and sent
+ * with a single write, so a move that changes two tiles costs a few dozen bytes
+ * instead of the whole board. Messages and prompts must be under 80 characters.
+ */
+struct Renderer {
+    int fd; // where frames are written, a terminal or a client's socket
+    int rows; // map rows
+    int cols; // map columns
+    char *lastFrame; // rows * cols glyphs currently on screen
+    char lastMessage[80];
+    int drawn; // 0 until the first full frame has been sent
+    char *out; // the frame being assembled
+    size_t outLength;
+    size_t boardLength; // bytes the board takes in a full frame
+};
+
+/**
+ * Sets up a renderer for a map; the first frame it draws clears the screen.
+ *
+ * @param renderer The renderer to initialize, release it with freeRenderer.
+ * @param fd The file descriptor to write frames to (ignored on Windows, which uses stdout).
+ * @param rows The number of map rows.
+ * @param cols The number of map columns.
+ * @return 1 on success, 0 if memory could not be allocated.
+ */
+int initRenderer(struct Renderer *renderer, int fd, int rows, int cols) {
+    renderer->fd = fd;
+    renderer->rows = rows;
+    renderer->cols = cols;
+    renderer->drawn = 0;
+    renderer->lastMessage[0] = '\0';
+    renderer->outLength = 0;
+    renderer->boardLength = (size_t)rows * (2 * cols + 2);
+    renderer->lastFrame = malloc((size_t)rows * cols);
+    // a full frame plus room for the message and prompt lines; a changed-tile
+    // frame that would outgrow the board is sent as a full frame instead
+    renderer->out = malloc(renderer->boardLength + 512);
+    return renderer->lastFrame != NULL && renderer->out != NULL;
+}
+
+void freeRenderer(struct Renderer *renderer) {
+    free(renderer->lastFrame);
+    free(renderer->out);
+    renderer->lastFrame = NULL;
+    renderer->out = NULL;
+}
+
+// Appends a string to the frame being assembled
+void appendOutput(struct Renderer *renderer, const char *text) {
+    size_t length = strlen(text);
+    memcpy(renderer->out + renderer->outLength, text, length);
+    renderer->outLength += length;
+}
+
+// Appends an ANSI cursor move to a 1-based row and column
+void appendCursorMove(struct Renderer *renderer, int row, int col) {
+    renderer->outLength += sprintf(renderer->out + renderer->outLength, "\x1b[%d;%dH", row, col);
+}
+
+/**
+ * Sends the assembled frame in one go.
+ *
+ * @param renderer The renderer holding the frame.
+ * @return 1 if the whole frame was written, 0 if the write failed or would have blocked.
+ */
+int flushOutput(struct Renderer *renderer) {
+    int complete = 1;
+#ifdef _WIN32
+    fwrite(renderer->out, 1, renderer->outLength, stdout);
+    fflush(stdout);
+#else
+    if (renderer->fd == STDOUT_FILENO) {
+        fflush(stdout); // anything printf still holds has to come out first
+    }
+    const char *next = renderer->out;
+    size_t left = renderer->outLength;
+    while (left > 0) {
+        ssize_t written = write(renderer->fd, next, left);
+        if (written <= 0) {
+            complete = 0;
+            break;
+        }
+        next += written;
+        left -= written;
+    }
+#endif
+    renderer->outLength = 0;
+    return complete;
+}
+
+// Appends a frame that clears the screen and draws everything, formatting the board in bulk
+void appendFullFrame(struct Renderer *renderer, const struct Level *level, struct Point player, const char *message) {
+    int cols = renderer->cols;
+    appendOutput(renderer, "\x1b[H\x1b[2J"); // cursor home, clear the screen
+    appendOutput(renderer, message);
+    appendOutput(renderer, "\r\n");
+    for (int y = 0; y < renderer->rows; y++) {
+        char *line = renderer->out + renderer->outLength;
+        char *last = renderer->lastFrame + (size_t)y * cols;
+        for (int x = 0; x < cols; x++) {
+            last[x] = glyphAt(level, player, x, y);
+            line[2 * x] = last[x];
+            line[2 * x + 1] = ' ';
+        }
+        line[2 * cols] = '\r'; // a raw terminal on the far end of a socket won't add it
+        line[2 * cols + 1] = '\n';
+        renderer->outLength += 2 * cols + 2;
+    }
+    renderer->drawn = 1;
+}
+
+/**
+ * Appends only what changed since the last frame: the message line if its text
+ * changed, and each run of changed tiles behind one cursor move.
+ *
+ * @return 1 on success, 0 if so much changed that a full frame would be smaller.
+ */
+int appendChangedTiles(struct Renderer *renderer, const struct Level *level, struct Point player, const char *message) {
+    int cols = renderer->cols;
+    if (strcmp(message, renderer->lastMessage) != 0) {
+        appendCursorMove(renderer, 1, 1);
+        appendOutput(renderer, message);
+        appendOutput(renderer, "\x1b[K"); // clear what is left of the old message
+    }
+    for (int y = 0; y < renderer->rows; y++) {
+        char *last = renderer->lastFrame + (size_t)y * cols;
+        int inRun = 0;
+        for (int x = 0; x < cols; x++) {
+            char glyph = glyphAt(level, player, x, y);
+            if (glyph == last[x]) {
+                inRun = 0;
+                continue;
+            }
+            // a tile takes 2 bytes, plus a cursor move when it starts a run
+            if (renderer->outLength + (inRun ? 2 : 32) > renderer->boardLength) {
+                return 0;
+            }
+            if (!inRun) {
+                appendCursorMove(renderer, y + 2, 2 * x + 1);
+                inRun = 1;
+            }
+            renderer->out[renderer->outLength++] = glyph;
+            renderer->out[renderer->outLength++] = ' ';
+            last[x] = glyph;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Draws the message, the map with the player on it, and the prompt.
+ *
+ * The first frame clears the screen and formats every row in bulk. After that
+ * only runs of tiles whose glyph changed are sent, each behind one cursor move,
+ * and the message line only when its text changed. The cursor is left at the
+ * end of the prompt.
+ *
+ * @param renderer The renderer, which remembers what is on screen.
+ * @param level The level being played, its map the same size the renderer was set up for.
+ * @param player The player's location.
+ * @param message The message to show above the map.
+ * @param prompt The text to show below the map.
+ * @return 1 if the frame was sent in full, 0 otherwise.
+ */
+int renderFrame(struct Renderer *renderer, const struct Level *level, struct Point player,
+                const char *message, const char *prompt) {
+    if (!renderer->drawn) {
+        appendFullFrame(renderer, level, player, message);
+    } else if (!appendChangedTiles(renderer, level, player, message)) {
+        renderer->outLength = 0;
+        appendFullFrame(renderer, level, player, message);
+    }
+    snprintf(renderer->lastMessage, sizeof(renderer->lastMessage), "%s", message);
+
+    appendCursorMove(renderer, renderer->rows + 2, 1);
+    appendOutput(renderer, "\x1b[K"); // clear the old prompt and whatever was typed after it
+    appendOutput(renderer, prompt);
+    return flushOutput(renderer);
+}
+
+
+#ifndef _WIN32
+struct termios savedTerminal; // the terminal settings to put back on exit
+int terminalIsRaw = 0;
+
+void restoreTerminal(void) {
+    if (terminalIsRaw) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &savedTerminal);
+        terminalIsRaw = 0;
+    }
+}
+
+// Ctrl-C still works in raw mode, so put the terminal back before dying
+void restoreTerminalAndExit(int signal) {
+    restoreTerminal();
+    _exit(128 + signal);
+}
+#else
+// the Windows console is never switched out of line mode, so there is nothing to put back
+void restoreTerminal(void) {
+}
+#endif
+
+/**
+ * Switches the terminal to reading single keypresses without echo.
+ *
+ * The previous settings come back on exit or on Ctrl-C. When stdin is not a
+ * terminal (a pipe or a file) nothing changes and keys are read as they come.
+ *
+ * @return 1 if the terminal is now in raw mode, 0 otherwise.
+ */
+int enableRawInput(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    if (tcgetattr(STDIN_FILENO, &savedTerminal) != 0) {
+        return 0;
+    }
+    struct termios raw = savedTerminal;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0) {
+        return 0;
+    }
+    terminalIsRaw = 1;
+    atexit(restoreTerminal);
+    signal(SIGINT, restoreTerminalAndExit);
+    signal(SIGTERM, restoreTerminalAndExit);
+    return 1;
+#endif
+}
+
+/**
+ * Waits for the player's next key, then takes every other key already queued too.
+ *
+ * Whitespace is skipped, like scanf(" %c") used to. Coalescing the queue lets
+ * the game apply a burst of keys and draw a single frame for all of them.
+ *
+ * @param keys Filled in with the keys read, oldest first.
+ * @param capacity The most keys to take at once.
+ * @param arrival Set to when the first key arrived, from monotonicNanos.
+ * @return The number of keys read, 0 at the end of input.
+ */
+int readKeys(char *keys, int capacity, long long *arrival) {
+#ifdef _WIN32
+    if (scanf(" %c", &keys[0]) != 1) {
+        return 0;
+    }
+    *arrival = monotonicNanos();
+    return 1;
+#else
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    int count = 0;
+    while (count == 0) {
+        if (poll(&input, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        *arrival = monotonicNanos();
+        // drain whatever is queued without blocking again
+        do {
+            ssize_t length = read(STDIN_FILENO, keys + count, capacity - count);
+            if (length <= 0) {
+                return count; // end of input
+            }
+            // keep the keys in place, closing up the gaps whitespace leaves
+            const char *fresh = keys + count;
+            for (ssize_t i = 0; i < length; i++) {
+                if (fresh[i] != ' ' && fresh[i] != '\n' && fresh[i] != '\r' && fresh[i] != '\t') {
+                    keys[count++] = fresh[i];
+                }
+            }
+        } while (count < capacity && poll(&input, 1, 0) > 0);
+    }
+    return count;
+#endif
+}
+
+
+#ifdef BENCHMARK
+/*
+Benchmark build: gcc -O2 -DBENCHMARK ./maptest3.c -o ./bench3 -lpthread
+
+Runs independent level generations on 1..N threads at once, each thread with its
+own Generator and Level, and reports how many levels per second each thread count
+manages. Every stage of generateLevel is timed separately with the monotonic clock,
+and the single-threaded run prints p50/p99/p99.9 latencies per stage, so a
+regression in any one stage stands out even when the total barely moves.
+Usage: ./bench3 [levels per thread] [max threads] [grid columns] [grid rows]
+
+./bench3 --paths [queries] [grid columns] [grid rows] instead times path
+queries with A* and jump point search, on the 3x3 grid and on a large one.
+*/
+
+// log-linear latency buckets: 16 sub-buckets per power of two, so every
+// reported percentile is within about 6% of the true value
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS (61 * HISTOGRAM_SUB_BUCKETS)
+
+struct Histogram {
+    long long counts[HISTOGRAM_BUCKETS];
+    long long samples;
+    long long sum;
+    long long max;
+};
+
+int histogramBucket(long long nanos) {
+    if (nanos < HISTOGRAM_SUB_BUCKETS) {
+        return nanos < 0 ? 0 : (int)nanos;
+    }
+    int msb = 63 - __builtin_clzll((unsigned long long)nanos);
+    int sub = (int)(nanos >> (msb - 4)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (msb - 3) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+// the largest value that falls into a bucket
+long long histogramBucketLimit(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int msb = bucket / HISTOGRAM_SUB_BUCKETS + 3;
+    long long sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << (msb - 4)) - 1;
+}
+
+void histogramRecord(struct Histogram *histogram, long long nanos) {
+    histogram->counts[histogramBucket(nanos)]++;
+    histogram->samples++;
+    histogram->sum += nanos;
+    if (nanos > histogram->max) {
+        histogram->max = nanos;
+    }
+}
+
+// returns the smallest bucket limit that covers the given fraction of the samples
+long long histogramPercentile(struct Histogram *histogram, double fraction) {
+    long long wanted = (long long)(fraction * histogram->samples);
+    if (wanted < 1) {
+        wanted = 1;
+    }
+    long long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= wanted) {
+            long long limit = histogramBucketLimit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void printHistogram(const char *name, struct Histogram *histogram) {
+    printf("%-22s %9.0f %9lld %9lld %9lld %9lld\n", name,
+           histogram->samples ? (double)histogram->sum / histogram->samples : 0.0,
+           histogramPercentile(histogram, 0.50), histogramPercentile(histogram, 0.99),
+           histogramPercentile(histogram, 0.999), histogram->max);
+}
+
+// checks that a corridor set only joins rooms of the layout, and joins all of them
+int corridorSetConnectsLayout(int layout, int corridorSet) {
+    int reached = layout & -layout;
+    for (int pass = 0; pass < 9; pass++) {
+        for (int edge = 0; edge < 12; edge++) {
+            int ends = (1 << corridorEdges[edge][0]) | (1 << corridorEdges[edge][1]);
+            if (corridorSet & (1 << edge)) {
+                if ((ends & layout) != ends) {
+                    return 0;
+                }
+                if (reached & ends) {
+                    reached |= ends;
+                }
+            }
+        }
+    }
+    return reached == layout;
+}
+
+// checks that every entry of connectedLayouts is connected and sits in the right
+// room-count group, and that every corridor set connects the rooms of its layout
+int verifyConnectedLayouts(void) {
+    for (int numRooms = 5; numRooms <= 9; numRooms++) {
+        for (int i = connectedLayoutsStart[numRooms - 5]; i < connectedLayoutsStart[numRooms - 4]; i++) {
+            if (countRooms(connectedLayouts[i]) != numRooms || !quadIsConnected(connectedLayouts[i])) {
+                printf("Error: layout 0x%03x at index %d is not a connected %d room layout\n", connectedLayouts[i], i, numRooms);
+                return 0;
+            }
+            for (int j = corridorSetsStart[i]; j < corridorSetsStart[i + 1]; j++) {
+                if (!corridorSetConnectsLayout(connectedLayouts[i], corridorSets[j])) {
+                    printf("Error: corridor set 0x%03x does not connect layout 0x%03x\n", corridorSets[j], connectedLayouts[i]);
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * Checks a sample of generated levels with the bit-plane kernels: every corridor
+ * end must have a door, every door must join floor to corridor, and no corridor
+ * tile may have only a single walkable neighbour (a dead end). Each corridor's
+ * polyline must also trace corridor tiles between the two ends it recorded.
+ */
+int auditLevels(int count, int gridCols, int gridRows) {
+    struct Generator gen;
+    struct Level level;
+    struct TilePlanes planes;
+    if (!initGenerator(&gen, gridCols, gridRows)) {
+        return 0;
+    }
+    int rows = gridRows * CELL_ROWS;
+    if (!initTilePlanes(&planes, rows, gridCols * CELL_COLS)) {
+        freeGenerator(&gen);
+        return 0;
+    }
+    // a result plane, its padding zeroed once and never written
+    uint64_t *scratch = calloc(planes.planeWords, sizeof(uint64_t));
+    int tileCapacity = rows * gridCols * CELL_COLS;
+    struct Point *tiles = malloc(tileCapacity * sizeof(struct Point));
+    if (scratch == NULL || tiles == NULL) {
+        free(scratch);
+        free(tiles);
+        freeTilePlanes(&planes);
+        freeGenerator(&gen);
+        return 0;
+    }
+    long long start = monotonicNanos();
+    int ok = 1;
+    for (int i = 0; i < count && ok; i++) {
+        uint64_t seed = levelSeed(1, i);
+        if (!generateLevel(&gen, seed, &level)) {
+            break;
+        }
+        buildTilePlanes(&planes, &level.tiles);
+
+        long doors = countPlane(&planes, tilePlane(&planes, TILE_CLASS_DOOR));
+        validDoors(&planes, scratch);
+        long goodDoors = countPlane(&planes, scratch);
+        exactlyNeighbors8(&planes, scratch, tilePlane(&planes, TILE_CLASS_PASSABLE), 1);
+        uint64_t *corridor = tilePlane(&planes, TILE_CLASS_CORRIDOR);
+        long deadEnds = 0;
+        for (size_t w = 0; w < planes.planeWords; w++) {
+            deadEnds += __builtin_popcountll(scratch[w] & corridor[w]);
+        }
+
+        if (doors != 2 * level.corridorCount || goodDoors != doors || deadEnds != 0) {
+            printf("Error: seed %" PRIu64 " has %ld doors (%ld valid) for %d corridors and %ld dead ends\n",
+                   seed, doors, goodDoors, level.corridorCount, deadEnds);
+            ok = 0;
+        }
+
+        // every corridor's polyline runs over corridor tiles from one recorded end to the other
+        for (int c = 0; c < level.corridorCount && ok; c++) {
+            int length = corridorTiles(&level, c, tiles, tileCapacity);
+            struct CorridorEnd *ends = &level.corridorEnds[2 * c];
+            int onCorridor = length <= tileCapacity;
+            for (int t = 0; t < length && onCorridor; t++) {
+                onCorridor = getTile(&level.tiles, tiles[t].x, tiles[t].y) == TILE_CORRIDOR;
+            }
+            if (!onCorridor || memcmp(&tiles[0], &ends[0].point, sizeof(struct Point)) != 0
+                || memcmp(&tiles[length - 1], &ends[1].point, sizeof(struct Point)) != 0
+                || level.corridors[c].rooms[0] != ends[0].room || level.corridors[c].rooms[1] != ends[1].room) {
+                printf("Error: seed %" PRIu64 " corridor %d does not follow its carved tiles\n", seed, c);
+                ok = 0;
+            }
+        }
+        freeLevel(&level);
+    }
+    printf("Audited %d levels on a %dx%d grid with bit-plane kernels in %.3f seconds\n",
+           count, gridCols, gridRows, (monotonicNanos() - start) / 1e9);
+    free(scratch);
+    free(tiles);
+    freeTilePlanes(&planes);
+    freeGenerator(&gen);
+    return ok;
+}
+
+/**
+ * Times path queries between random room tiles of a level, with A* and with
+ * jump point search, and checks the two always agree on the length, and that
+ * the level's distance fields agree with them.
+ *
+ * @param queries The number of queries to run with each search.
+ * @param gridCols The number of cells across the level.
+ * @param gridRows The number of cells down the level.
+ * @return 1 if every query found the same length both ways, 0 otherwise.
+ */
+int benchmarkPaths(int queries, int gridCols, int gridRows) {
+    struct Generator gen;
+    struct Level level;
+    struct PathFinder finder;
+    if (!initGenerator(&gen, gridCols, gridRows)) {
+        return 0;
+    }
+    if (!generateLevel(&gen, levelSeed(1, 0), &level) || !initPathFinder(&finder, &level)) {
+        printf("Error: could not allocate the level\n");
+        return 0;
+    }
+    // both searches answer the same queries, drawn up front
+    struct Point *ends = malloc(2 * queries * sizeof(struct Point));
+    int *lengths = malloc(queries * sizeof(int));
+    struct Point *path = malloc((size_t)finder.rows * finder.cols * sizeof(struct Point));
+    if (ends == NULL || lengths == NULL || path == NULL) {
+        printf("Error: could not allocate the path queries\n");
+        free(ends);
+        free(lengths);
+        free(path);
+        freePathFinder(&finder);
+        freeLevel(&level);
+        freeGenerator(&gen);
+        return 0;
+    }
+    struct Rng rng;
+    rngSeed(&rng, 1, STREAM_PLACEMENT);
+    for (int i = 0; i < 2 * queries; i++) {
+        int room = rngRange(&rng, level.roomCount);
+        ends[i].x = level.rooms.x[room] + 1 + rngRange(&rng, level.rooms.width[room] - 2);
+        ends[i].y = level.rooms.y[room] + 1 + rngRange(&rng, level.rooms.height[room] - 2);
+    }
 
-    int farthestFromExit = farthestRoom(farthestRoomIndex, dynamicRoomCount, connections);
+    printf("\nPath queries between room tiles on a %dx%d grid (%dx%d tiles)\n",
+           gridCols, gridRows, finder.cols, finder.rows);
+    const char *searchNames[2] = {"A*", "jump point"};
+    int mismatches = 0;
+    int outOfMemory = 0; // searches whose heap could not grow
+    for (int jump = 0; jump <= 1; jump++) {
+        long totalLength = 0;
+        finder.pushed = 0;
+        long long start = monotonicNanos();
+        for (int i = 0; i < queries; i++) {
+            int length = findPath(&finder, ends[2 * i], ends[2 * i + 1], jump, path, finder.rows * finder.cols);
+            outOfMemory += length == -2;
+            if (jump && length != lengths[i]) {
+                mismatches++;
+            }
+            lengths[i] = length;
+            totalLength += length;
+        }
+        double seconds = (monotonicNanos() - start) / 1e9;
+        printf("%-11s %10.0f queries/sec, %.1f steps and %.1f heap pushes per query\n", searchNames[jump],
+               queries / seconds, (double)totalLength / queries, (double)finder.pushed / queries);
+    }
+    if (mismatches > 0) {
+        printf("Error: jump point search disagreed with A* on %d of %d paths\n", mismatches, queries);
+    }
+    // the same queries over the door graph, which must find the same lengths
+    struct RoomRoutes routes;
+    long long buildStart = monotonicNanos();
+    if (!initRoomRoutes(&routes, &level)) {
+        printf("Error: could not allocate the room routes\n");
+        return 0;
+    }
+    double buildSeconds = (monotonicNanos() - buildStart) / 1e9;
+    int routeMismatches = 0;
+    long waypoints = 0;
+    long long start = monotonicNanos();
+    for (int i = 0; i < queries; i++) {
+        int count;
+        int length = findRoute(&routes, ends[2 * i], ends[2 * i + 1], path, finder.rows * finder.cols, &count);
+        outOfMemory += length == -2;
+        if (length != lengths[i]) {
+            routeMismatches++;
+        }
+        waypoints += count;
+    }
+    double seconds = (monotonicNanos() - start) / 1e9;
+    printf("%-11s %10.0f queries/sec, %.1f waypoints per route, %d doors and %d door links built in %.3f ms\n",
+           "room graph", queries / seconds, (double)waypoints / queries, routes.nodeCount,
+           routes.edgeOffsets[routes.nodeCount], buildSeconds * 1e3);
+    // walking the legs between waypoints has to add up to the route
+    for (int i = 0; i < queries && i < 200; i++) {
+        int count;
+        int length = findRoute(&routes, ends[2 * i], ends[2 * i + 1], path, finder.rows * finder.cols, &count);
+        struct Point *legs = malloc(count * sizeof(struct Point));
+        if (legs == NULL) {
+            printf("Error: out of memory for a route's legs\n");
+            routeMismatches++;
+            break;
+        }
+        memcpy(legs, path, count * sizeof(struct Point));
+        struct Point from = ends[2 * i];
+        for (int leg = 0; leg < count; leg++) {
+            length -= findPath(&finder, from, legs[leg], 1, NULL, 0);
+            from = legs[leg];
+        }
+        routeMismatches += length != 0;
+        free(legs);
+    }
+    if (outOfMemory > 0) {
+        printf("Error: %d path searches ran out of memory\n", outOfMemory);
+        mismatches += outOfMemory;
+    }
+    if (routeMismatches > 0) {
+        printf("Error: the room graph disagreed with tile search on %d routes\n", routeMismatches);
+        mismatches += routeMismatches;
+    }
+    freeRoomRoutes(&routes);
 
-    // printf("The index of the top left room is %d (quad %d)\n", indexOfTopLeftRoom, rooms[indexOfTopLeftRoom].wallChar - '0');
-    // printf("The index of the farthest room from the exit is %d (quad %d)\n", farthestFromExit, rooms[farthestFromExit].wallChar - '0');
+    // the level's distance fields have to agree with searching all the way
+    long long fieldStart = monotonicNanos();
+    if (!buildDistanceFields(&gen, &level)) {
+        printf("Error: could not allocate the distance fields\n");
+        return 0;
+    }
+    printf("Distance fields to the exit and the treasure built in %.3f ms\n", (monotonicNanos() - fieldStart) / 1e6);
+    int fieldMismatches = 0;
+    for (int i = 0; i < queries && i < 1000; i++) {
+        if (findPath(&finder, ends[i], level.exitLocation, 1, NULL, 0) != distanceToExit(&level, ends[i])
+            || findPath(&finder, ends[i], level.treasureLocation, 1, NULL, 0) != distanceToTreasure(&level, ends[i])) {
+            fieldMismatches++;
+        }
+    }
+    if (fieldMismatches > 0) {
+        printf("Error: the distance fields disagreed with path search from %d tiles\n", fieldMismatches);
+        mismatches += fieldMismatches;
+    }
+    free(ends);
+    free(lengths);
+    free(path);
+    freePathFinder(&finder);
+    freeLevel(&level);
+    freeGenerator(&gen);
+    return mismatches == 0;
+}
 
-    if(farthestFromExit == indexOfTopLeftRoom) {
-        // printf("??? The farthest room from the exit is the starting room, placing treasure in a different room\n");
-        //// TODO: fix bug where the treasure is sometimes placed in the starting room
-        treasureRoomIndex = findMinConnectedRoomOfNonIgnoredRooms(connectionsCount, dynamicRoomCount, indexOfTopLeftRoom, farthestRoomIndex);
-        // printf("??? The treasure room is in quad %d\n", rooms[treasureRoomIndex].wallChar - '0');
-    } else {
-        // printf("--- The farthest room from the exit is in quad %d\n", rooms[farthestFromExit].wallChar - '0');
-        treasureRoomIndex = farthestFromExit;
+struct BenchmarkWorker {
+    pthread_t thread;
+    uint64_t firstLevel; // index of this worker's first level within the run
+    int levels;
+    int gridCols;
+    int gridRows;
+    long checksum; // keeps the compiler from discarding the generated levels
+    struct Histogram stages[STAGE_COUNT + 1]; // one per stage, plus the whole of generateLevel
+};
+
+void *benchmarkWorker(void *arg) {
+    struct BenchmarkWorker *worker = arg;
+    long long stageNanos[STAGE_COUNT];
+    struct Generator gen;
+    struct Level level;
+    memset(worker->stages, 0, sizeof(worker->stages));
+    if (!initGenerator(&gen, worker->gridCols, worker->gridRows)) {
+        return NULL;
+    }
+    gen.stageNanos = stageNanos;
+    for (int i = 0; i < worker->levels; i++) {
+        memset(stageNanos, 0, sizeof(stageNanos));
+        long long start = monotonicNanos();
+        if (!generateLevel(&gen, levelSeed(0, worker->firstLevel + i), &level)) {
+            break;
+        }
+        histogramRecord(&worker->stages[STAGE_COUNT], monotonicNanos() - start);
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            histogramRecord(&worker->stages[stage], stageNanos[stage]);
+        }
+        worker->checksum += level.exitLocation.x + level.treasureLocation.y + level.roomCount;
+        freeLevel(&level);
     }
-    // printf("Placing the treasure in room %d (quad %c)\n", treasureRoomIndex, rooms[treasureRoomIndex].wallChar);
+    freeGenerator(&gen);
+    return NULL;
+}
 
-    // place the treasure in the treasureRoom
-    treasureLocation = centerPointOfRectangle(rooms[treasureRoomIndex]);
-    matrix[treasureLocation.y][treasureLocation.x] = TREASURE_CHAR;
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--paths") == 0) {
+        int queries = argc > 2 ? atoi(argv[2]) : 100000;
+        int pathCols = argc > 3 ? atoi(argv[3]) : 100;
+        int pathRows = argc > 4 ? atoi(argv[4]) : pathCols;
+        if (queries < 1) {
+            printf("Usage: %s --paths [queries] [grid columns] [grid rows]\n", argv[0]);
+            return 1;
+        }
+        // a query on a large grid searches thousands of times the tiles
+        return !(benchmarkPaths(queries, 3, 3) && benchmarkPaths(queries / 100 + 1, pathCols, pathRows));
+    }
+    int levelsPerThread = argc > 1 ? atoi(argv[1]) : 1000000;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int gridCols = argc > 3 ? atoi(argv[3]) : 3;
+    int gridRows = argc > 4 ? atoi(argv[4]) : gridCols;
+    if (levelsPerThread < 1 || maxThreads < 1) {
+        printf("Usage: %s [levels per thread] [max threads] [grid columns] [grid rows]\n"
+               "       %s --paths [queries] [grid columns] [grid rows]\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    // the tables only cover 3x3, so larger grids get audited too
+    if (!verifyConnectedLayouts() || !auditLevels(10000, 3, 3) || !auditLevels(100, 40, 40)) {
+        return 1;
+    }
+    if (!(gridCols == 3 && gridRows == 3) && !auditLevels(100, gridCols, gridRows)) {
+        return 1;
+    }
+    printf("\nGenerating levels on a %dx%d grid\n", gridCols, gridRows);
+
+    // workers[0] runs the single-thread pass alone and keeps its stage latencies
+    // for the table at the end, the other runs use the workers after it
+    struct BenchmarkWorker *workers = malloc((maxThreads + 1) * sizeof(struct BenchmarkWorker));
+    if (workers == NULL) {
+        printf("Error: could not allocate the benchmark workers\n");
+        return 1;
+    }
+    double singleThreadRate = 0;
+    printf("threads  levels/sec  speedup\n");
+    for (int threads = 1; threads <= maxThreads; threads++) {
+        struct BenchmarkWorker *run = threads == 1 ? workers : workers + 1;
+        long long start = monotonicNanos();
+        int started = 0;
+        for (int t = 0; t < threads; t++) {
+            run[t].firstLevel = (uint64_t)t * levelsPerThread;
+            run[t].levels = levelsPerThread;
+            run[t].gridCols = gridCols;
+            run[t].gridRows = gridRows;
+            run[t].checksum = 0;
+            if (pthread_create(&run[t].thread, NULL, benchmarkWorker, &run[t]) != 0) {
+                printf("Error: could not start benchmark thread %d\n", t + 1);
+                break;
+            }
+            started++;
+        }
+        long checksum = 0;
+        for (int t = 0; t < started; t++) {
+            pthread_join(run[t].thread, NULL);
+            checksum += run[t].checksum;
+        }
+        if (started < threads) {
+            free(workers);
+            return 1;
+        }
+        double rate = (double)threads * levelsPerThread / ((monotonicNanos() - start) / 1e9);
+        if (threads == 1) {
+            singleThreadRate = rate;
+        }
+        printf("%7d  %10.0f  %6.2fx  (checksum %ld)\n", threads, rate, rate / singleThreadRate, checksum);
+    }
+
+    printf("\nPer-stage latency over %d levels on 1 thread (nanoseconds):\n", levelsPerThread);
+    printf("%-22s %9s %9s %9s %9s %9s\n", "stage", "mean", "p50", "p99", "p99.9", "max");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        printHistogram(stageNames[stage], &workers[0].stages[stage]);
+    }
+    printHistogram("generateLevel", &workers[0].stages[STAGE_COUNT]);
+    free(workers);
+    return 0;
+}
+#elif defined(HEADLESS)
+/*
+Headless build: gcc -O2 -DHEADLESS ./maptest3.c -o ./headless3
+
+Plays random moves through step() with no terminal I/O at all, so the cost of
+the gameplay logic can be measured on its own. Each level gets up to
+HEADLESS_MOVES_PER_LEVEL moves before the bot moves on to the next one.
+
+./headless3 --replay script... instead replays move scripts at full speed and
+checks where each game ended up. A script is a text file of lines like:
+
+    # comments start with '#'
+    seed 1715609156
+    moves dddssswwa    (any number of moves lines, keys as in the game)
+    expect result won  (won, quit or playing)
+    expect treasure 1
+    expect position 12 7
+
+Every script needs its seed line. A script without expect lines just prints
+its final state, ready to be copied into it.
+
+./headless3 --cache [games] [seeds] [capacity] starts games on seeds drawn
+at random from a pool, through a LevelCache and by generating every level, and
+compares the two.
+
+./headless3 --pack path [seed...] writes the levels for the seeds (the fav
+seeds by default) to a level pack, then opens every level from it, checks it
+against a freshly generated one and times both ways of getting a level.
+*/
+#define HEADLESS_MOVES_PER_LEVEL 10000
+
+const uint64_t favSeeds[] = {1715544555, 0, 19, 1715568562, 1715609077, 1715609839};
+
+struct ReplayScript {
+    uint64_t seed;
+    char *moves;
+    long moveCount;
+    char expectResult[16]; // "won", "quit" or "playing", empty when not checked
+    int expectTreasure; // -1 when not checked
+    struct Point expectPosition; // x is -1 when not checked
+};
+
+/**
+ * Reads a move script, see the comment above for the format.
+ *
+ * @param path The script's file name.
+ * @param script Filled in, free script->moves when done.
+ * @return 1 on success, 0 if the file could not be read, has a bad line or has no seed.
+ */
+int loadReplayScript(const char *path, struct ReplayScript *script) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Error: could not open %s\n", path);
+        return 0;
+    }
+    memset(script, 0, sizeof(*script));
+    script->expectTreasure = -1;
+    script->expectPosition.x = -1;
+    long capacity = 256;
+    script->moves = malloc(capacity);
+    if (script->moves == NULL) {
+        printf("Error: out of memory reading %s\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    char keyword[16];
+    int ok = 1;
+    int hasSeed = 0;
+    while (ok && fscanf(file, "%15s", keyword) == 1) {
+        if (keyword[0] == '#') {
+            int c;
+            while ((c = getc(file)) != EOF && c != '\n') {}
+        } else if (strcmp(keyword, "seed") == 0) {
+            ok = fscanf(file, "%" SCNu64, &script->seed) == 1;
+            hasSeed = 1;
+        } else if (strcmp(keyword, "moves") == 0) {
+            int c;
+            while ((c = getc(file)) != EOF && c != '\n') {
+                if (c == ' ' || c == '\t' || c == '\r') {
+                    continue;
+                }
+                if (script->moveCount == capacity) {
+                    char *grown = realloc(script->moves, 2 * capacity);
+                    if (grown == NULL) {
+                        printf("Error: out of memory reading %s\n", path);
+                        fclose(file);
+                        free(script->moves);
+                        return 0;
+                    }
+                    script->moves = grown;
+                    capacity *= 2;
+                }
+                script->moves[script->moveCount++] = c;
+            }
+        } else if (strcmp(keyword, "expect") == 0 && fscanf(file, "%15s", keyword) == 1) {
+            if (strcmp(keyword, "result") == 0) {
+                ok = fscanf(file, "%15s", script->expectResult) == 1;
+            } else if (strcmp(keyword, "treasure") == 0) {
+                ok = fscanf(file, "%d", &script->expectTreasure) == 1;
+            } else if (strcmp(keyword, "position") == 0) {
+                ok = fscanf(file, "%d %d", &script->expectPosition.x, &script->expectPosition.y) == 2;
+            } else {
+                ok = 0;
+            }
+        } else {
+            ok = 0;
+        }
+    }
+    fclose(file);
+    if (!ok) {
+        printf("Error: %s has a bad line near \"%s\"\n", path, keyword);
+    } else if (!hasSeed) {
+        printf("Error: %s has no seed line\n", path);
+        ok = 0;
+    }
+    if (!ok) {
+        free(script->moves);
+    }
+    return ok;
+}
+
+/**
+ * Replays move scripts as fast as step() allows and checks each final state.
+ *
+ * @param count The number of scripts.
+ * @param paths Their file names.
+ * @return 0 if every script met its expectations, 1 otherwise.
+ */
+int replayScripts(int count, char *paths[]) {
+    struct Generator gen;
+    if (!initGenerator(&gen, 3, 3)) {
+        return 1;
+    }
+    long moves = 0;
+    long long stepNanos = 0;
+    int failed = 0;
+    for (int s = 0; s < count; s++) {
+        struct ReplayScript script;
+        struct GameState game;
+        if (!loadReplayScript(paths[s], &script)) {
+            failed++;
+            continue;
+        }
+        if (!initGame(&game, &gen, script.seed)) {
+            printf("Error: could not allocate the level\n");
+            return 1;
+        }
+
+        enum StepResult last = STEP_MOVED;
+        long long start = monotonicNanos();
+        long i;
+        for (i = 0; i < script.moveCount && !game.finished; i++) {
+            last = step(&game, actionFromKey(script.moves[i]));
+        }
+        stepNanos += monotonicNanos() - start;
+        moves += i;
+
+        const char *result = !game.finished ? "playing" : last == STEP_WON ? "won" : "quit";
+        int good = 1;
+        if (script.expectResult[0] && strcmp(script.expectResult, result) != 0) {
+            printf("FAIL %s: expected result %s, got %s\n", paths[s], script.expectResult, result);
+            good = 0;
+        }
+        if (script.expectTreasure != -1 && script.expectTreasure != game.hasTreasure) {
+            printf("FAIL %s: expected treasure %d, got %d\n", paths[s], script.expectTreasure, game.hasTreasure);
+            good = 0;
+        }
+        if (script.expectPosition.x != -1 &&
+            (script.expectPosition.x != game.playerLocation.x || script.expectPosition.y != game.playerLocation.y)) {
+            printf("FAIL %s: expected position %d %d, got %d %d\n", paths[s], script.expectPosition.x,
+                   script.expectPosition.y, game.playerLocation.x, game.playerLocation.y);
+            good = 0;
+        }
+        if (!script.expectResult[0] && script.expectTreasure == -1 && script.expectPosition.x == -1) {
+            printf("%s:\nexpect result %s\nexpect treasure %d\nexpect position %d %d\n", paths[s], result,
+                   game.hasTreasure, game.playerLocation.x, game.playerLocation.y);
+        }
+        failed += !good;
+        free(script.moves);
+        freeGame(&game);
+    }
+
+    printf("Replayed %d scripts, %d failed: %ld moves in %.6f seconds of step(), %.0f moves/sec\n",
+           count, failed, moves, stepNanos / 1e9, stepNanos > 0 ? moves / (stepNanos / 1e9) : 0.0);
+    freeGenerator(&gen);
+    return failed > 0;
+}
+
+/**
+ * Starts games on random seeds from a pool with and without a level cache.
+ *
+ * @param games The number of games to start each way.
+ * @param seeds The number of distinct seeds they are drawn from.
+ * @param capacity The cache's capacity.
+ * @return 0 on success, 1 if memory could not be allocated.
+ */
+int benchmarkCache(long games, long seeds, int capacity) {
+    struct Generator gen;
+    struct LevelCache cache;
+    if (games < 1 || seeds < 1 || capacity < 1 || !initGenerator(&gen, 3, 3) || !initLevelCache(&cache, capacity)) {
+        printf("Usage: --cache [games] [seeds] [capacity], all at least 1\n");
+        return 1;
+    }
+    long long nanos[2] = {0, 0}; // cached, then generated
+    for (int cached = 1; cached >= 0; cached--) {
+        struct Rng picker;
+        rngSeed(&picker, 0, STREAM_BOT); // both runs see the same seeds
+        long long start = monotonicNanos();
+        for (long i = 0; i < games; i++) {
+            struct GameState game;
+            uint64_t seed = levelSeed(0, ((uint64_t)rngNext(&picker) << 32 | rngNext(&picker)) % seeds);
+            int started = cached ? initCachedGame(&game, &cache, &gen, seed) : initGame(&game, &gen, seed);
+            if (!started) {
+                printf("Error: could not allocate the level\n");
+                return 1;
+            }
+            freeGame(&game);
+        }
+        nanos[!cached] = monotonicNanos() - start;
+    }
+    printf("%ld games on %ld seeds, cache of %d levels: %ld hits, %ld misses, %ld evictions (%.1f%% hit rate)\n",
+           games, seeds, capacity, cache.hits, cache.misses, cache.evictions, 100.0 * cache.hits / games);
+    printf("Starting a game: %.0f ns cached, %.0f ns generating every level\n",
+           (double)nanos[0] / games, (double)nanos[1] / games);
+    freeLevelCache(&cache);
+    freeGenerator(&gen);
+    return 0;
+}
+
+// Returns 1 if two levels match in every array and field a level pack stores
+int levelsMatch(const struct Level *a, const struct Level *b) {
+    if (a->tiles.rows != b->tiles.rows || a->tiles.cols != b->tiles.cols || a->roomCount != b->roomCount
+        || a->tiles.allocatedChunks != b->tiles.allocatedChunks
+        || a->rooms.gridCols != b->rooms.gridCols || a->rooms.cells != b->rooms.cells
+        || a->corridorCount != b->corridorCount || a->corridorRunCount != b->corridorRunCount
+        || a->startRoomIndex != b->startRoomIndex || a->exitRoomIndex != b->exitRoomIndex
+        || a->treasureRoomIndex != b->treasureRoomIndex
+        || memcmp(&a->playerLocation, &b->playerLocation, sizeof(struct Point)) != 0
+        || memcmp(&a->exitLocation, &b->exitLocation, sizeof(struct Point)) != 0
+        || memcmp(&a->treasureLocation, &b->treasureLocation, sizeof(struct Point)) != 0
+        || memcmp(a->rooms.x, b->rooms.x, 5 * a->roomCount * sizeof(uint16_t)) != 0
+        || memcmp(a->rooms.roomOfQuadrant, b->rooms.roomOfQuadrant, a->rooms.cells * sizeof(int)) != 0
+        || memcmp(a->corridors, b->corridors, a->corridorCount * sizeof(struct Corridor)) != 0
+        || memcmp(a->corridorRuns, b->corridorRuns, a->corridorRunCount * sizeof(struct CorridorRun)) != 0
+        || memcmp(a->corridorEnds, b->corridorEnds, 2 * a->corridorCount * sizeof(struct CorridorEnd)) != 0
+        || memcmp(a->doors, b->doors, 2 * a->corridorCount * sizeof(struct Point)) != 0
+        || memcmp(a->connections.offsets, b->connections.offsets, (a->roomCount + 1) * sizeof(int)) != 0
+        || memcmp(a->connections.neighbors, b->connections.neighbors, 2 * a->corridorCount * sizeof(uint16_t)) != 0
+        || memcmp(a->connectionsCount, b->connectionsCount, a->roomCount * sizeof(int)) != 0
+        || memcmp(a->exitDistances, b->exitDistances, (size_t)a->tiles.rows * a->tiles.cols * sizeof(uint16_t)) != 0
+        || memcmp(a->treasureDistances, b->treasureDistances, (size_t)a->tiles.rows * a->tiles.cols * sizeof(uint16_t)) != 0) {
+        return 0;
+    }
+    for (int y = 0; y < a->tiles.rows; y++) {
+        for (int x = 0; x < a->tiles.cols; x++) {
+            if (getTile(&a->tiles, x, y) != getTile(&b->tiles, x, y)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * Packs the levels for some seeds, then checks and times opening them from the pack.
+ *
+ * @param path The pack file to write.
+ * @param count The number of seeds, 0 for the fav seeds.
+ * @param seeds The seeds as text.
+ * @return 0 if every level came back from the pack intact, 1 otherwise. Windows
+ *         can't map a pack, so there only the writing is done.
+ */
+int packLevels(const char *path, int count, char *seeds[]) {
+    int seedCount = count > 0 ? count : (int)(sizeof(favSeeds) / sizeof(favSeeds[0]));
+    uint64_t *levelSeeds = malloc(seedCount * sizeof(uint64_t));
+    struct Generator gen;
+    if (levelSeeds == NULL || !initGenerator(&gen, 3, 3)) {
+        free(levelSeeds);
+        return 1;
+    }
+    for (int i = 0; i < seedCount; i++) {
+        levelSeeds[i] = count > 0 ? strtoull(seeds[i], NULL, 10) : favSeeds[i];
+    }
+    int packed = writeLevelPack(path, &gen, levelSeeds, seedCount);
+    free(levelSeeds);
+#ifdef _WIN32
+    freeGenerator(&gen);
+    if (packed > 0) {
+        printf("Packed %d levels into %s, opening packs is not supported on Windows\n", packed, path);
+    }
+    return packed == 0;
+#else
+    struct LevelPack pack;
+    if (packed == 0 || !openLevelPack(&pack, path)) {
+        freeGenerator(&gen);
+        return 1;
+    }
+
+    int failed = 0;
+    long long loadNanos = 0, generateNanos = 0;
+    for (uint32_t i = 0; i < pack.levelCount; i++) {
+        struct Level loaded, generated;
+        long long start = monotonicNanos();
+        int index = findPackedLevel(&pack, pack.index[i].seed);
+        if (!loadPackedLevel(&pack, index, &loaded)) {
+            failed++;
+            continue;
+        }
+        long long middle = monotonicNanos();
+        if (!generateLevel(&gen, pack.index[i].seed, &generated) || !buildDistanceFields(&gen, &generated)) {
+            printf("Error: could not allocate the level\n");
+            return 1;
+        }
+        generateNanos += monotonicNanos() - middle;
+        loadNanos += middle - start;
+        if (!levelsMatch(&loaded, &generated)) {
+            printf("Seed %" PRIu64 ": the packed level differs from a generated one\n", pack.index[i].seed);
+            failed++;
+        }
+        freeLevel(&loaded);
+        freeLevel(&generated);
+    }
+    printf("Packed %d levels into %s (%zu bytes), %d failed to match\n", packed, path, pack.size, failed);
+    printf("Opening from the pack: %.0f ns per level, generating: %.0f ns per level\n",
+           (double)loadNanos / pack.levelCount, (double)generateNanos / pack.levelCount);
+    closeLevelPack(&pack);
+    freeGenerator(&gen);
+    return failed > 0;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2 && strcmp(argv[1], "--replay") == 0) {
+        return replayScripts(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "--cache") == 0) {
+        return benchmarkCache(argc > 2 ? atol(argv[2]) : 1000000, argc > 3 ? atol(argv[3]) : 1000,
+                              argc > 4 ? atoi(argv[4]) : 256);
+    }
+    if (argc > 2 && strcmp(argv[1], "--pack") == 0) {
+        return packLevels(argv[2], argc - 3, argv + 3);
+    }
+
+    long moves = argc > 1 ? atol(argv[1]) : 100000000;
+    uint64_t runSeed = argc > 2 ? strtoull(argv[2], NULL, 10) : 0;
+    if (moves < 1) {
+        printf("Usage: %s [moves] [seed]\n       %s --replay script...\n       %s --cache [games] [seeds] [capacity]\n"
+               "       %s --pack path [seed...]\n", argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    struct Generator gen;
+    if (!initGenerator(&gen, 3, 3)) {
+        return 1;
+    }
+    struct Rng bot;
+    rngSeed(&bot, runSeed, STREAM_BOT);
+
+    long results[STEP_RESULT_COUNT] = {0};
+    long played = 0;
+    long levels = 0;
+    long long stepNanos = 0; // time spent in step only, not generating levels
+    while (played < moves) {
+        struct GameState game;
+        if (!initGame(&game, &gen, levelSeed(runSeed, levels))) {
+            printf("Error: could not allocate the level\n");
+            return 1;
+        }
+        levels++;
+        long long start = monotonicNanos();
+        for (int i = 0; i < HEADLESS_MOVES_PER_LEVEL && played < moves && !game.finished; i++) {
+            results[step(&game, ACTION_NORTH + rngRange(&bot, 4))]++;
+            played++;
+        }
+        stepNanos += monotonicNanos() - start;
+        freeGame(&game);
+    }
+
+    printf("%ld moves over %ld levels: %ld moved, %ld blocked, %ld treasures, %ld wins\n",
+           played, levels, results[STEP_MOVED], results[STEP_BLOCKED], results[STEP_TREASURE], results[STEP_WON]);
+    printf("%.3f seconds in step(), %.0f moves/sec\n", stepNanos / 1e9, played / (stepNanos / 1e9));
+    freeGenerator(&gen);
+    return 0;
+}
+#elif defined(SERVER)
+/*
+Server build (Linux): gcc -O2 -DSERVER ./maptest3.c -o ./server3 -lpthread
+
+Serves many games at once over a Unix-domain socket. Every connection gets its
+own Session, a game on a fresh level plus a renderer writing to the socket, and
+keys sent by the client are played exactly as the terminal game plays them.
+Each thread runs one epoll loop over its own sessions; the listening socket is
+shared, and EPOLLEXCLUSIVE wakes only one thread per new connection.
+A client that can't take a whole frame without blocking is disconnected, so a
+slow client never stalls the others on its thread.
+With a seed count, sessions take turns on that many seeds (1 for a daily
+challenge), and each thread keeps the levels in a LevelCache instead of
+generating one per session.
+SIGINT or SIGTERM stops the server: every thread closes its sessions and the
+socket file is removed.
+Usage: ./server3 [socket path] [threads] [seeds]
+Play with: socat -,raw,echo=0 UNIX-CONNECT:/tmp/rogue.sock
+*/
+#define SERVER_EVENTS 64 // epoll events taken per wakeup
+#define SERVER_CACHED_LEVELS 256 // levels each thread keeps
+
+// One connected player
+struct Session {
+    int fd;
+    struct GameState game;
+    struct Renderer renderer;
+    char message[80];
+    struct Session *previous; // the thread's other sessions, so they can be closed when it stops
+    struct Session *next;
+};
+
+struct ServerThread {
+    pthread_t thread;
+    int listenFd;
+    int stopFd; // becomes readable when the server is stopping
+    uint64_t serverSeed;
+    uint64_t seedCount; // seeds the sessions share, 0 for a new one per session
+    struct Generator gen;
+    struct LevelCache cache;
+    int sessions; // sessions open on this thread
+    struct Session *firstSession;
+};
+
+atomic_ulong sessionsStarted; // numbers the sessions across threads, for their seeds
+
+const char *serverPrompt = "Press a direction to move (wasd) or q to quit: ";
+
+void closeSession(struct ServerThread *server, struct Session *session) {
+    *(session->previous ? &session->previous->next : &server->firstSession) = session->next;
+    if (session->next != NULL) {
+        session->next->previous = session->previous;
+    }
+    close(session->fd); // also drops it from the epoll set
+    freeRenderer(&session->renderer);
+    freeGame(&session->game);
+    free(session);
+    server->sessions--;
+}
+
+/**
+ * Starts a game for a new connection and sends its first frame.
+ *
+ * @param server The thread taking the connection.
+ * @param epollFd The thread's epoll instance.
+ * @param fd The connected, non-blocking socket; closed on failure.
+ */
+void openSession(struct ServerThread *server, int epollFd, int fd) {
+    struct Session *session = malloc(sizeof(struct Session));
+    if (session == NULL) {
+        close(fd);
+        return;
+    }
+    session->fd = fd;
+    uint64_t sessionIndex = atomic_fetch_add(&sessionsStarted, 1);
+    uint64_t seed = levelSeed(server->serverSeed, server->seedCount ? sessionIndex % server->seedCount : sessionIndex);
+    int started = server->seedCount ? initCachedGame(&session->game, &server->cache, &server->gen, seed)
+                                    : initGame(&session->game, &server->gen, seed);
+    if (!started) {
+        printf("Error: could not allocate the level\n");
+        free(session);
+        close(fd);
+        return;
+    }
+    struct TileMap *map = &session->game.level.tiles;
+    if (!initRenderer(&session->renderer, fd, map->rows, map->cols)) {
+        printf("Error: could not allocate the renderer\n");
+        freeRenderer(&session->renderer);
+        freeGame(&session->game);
+        free(session);
+        close(fd);
+        return;
+    }
+    server->sessions++;
+    session->previous = NULL;
+    session->next = server->firstSession;
+    if (session->next != NULL) {
+        session->next->previous = session;
+    }
+    server->firstSession = session;
+    snprintf(session->message, sizeof(session->message), "Welcome to Rogue Study! Seed %" PRIu64, seed);
+
+    struct epoll_event event = {EPOLLIN | EPOLLRDHUP, {.ptr = session}};
+    if (!renderFrame(&session->renderer, &session->game.level, session->game.playerLocation, session->message, serverPrompt)
+        || epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        closeSession(server, session);
+    }
+}
+
+/**
+ * Plays every key a client has sent and answers with one frame.
+ *
+ * @param session The session whose socket is readable.
+ * @return 1 if the session goes on, 0 if it has ended and should be closed.
+ */
+int serveSession(struct Session *session) {
+    char keys[64];
+    ssize_t length = read(session->fd, keys, sizeof(keys));
+    if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 1; // nothing to read after all
+    }
+    if (length <= 0) {
+        return 0; // the client hung up
+    }
+    struct GameState *game = &session->game;
+    for (ssize_t i = 0; i < length && !game->finished; i++) {
+        if (keys[i] == ' ' || keys[i] == '\n' || keys[i] == '\r' || keys[i] == '\t') {
+            continue;
+        }
+        strcpy(session->message, stepMessages[step(game, actionFromKey(keys[i]))]);
+    }
+    int sent = renderFrame(&session->renderer, &game->level, game->playerLocation, session->message,
+                           game->finished ? "Thanks for playing!\r\n" : serverPrompt);
+    return sent && !game->finished;
+}
+
+// Runs one thread's event loop: accepts connections and serves its own sessions until the server stops
+void *serverLoop(void *arg) {
+    struct ServerThread *server = arg;
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    // a NULL pointer marks the listening socket, the thread itself the stop pipe,
+    // and every other event is a session
+    struct epoll_event listenEvent = {EPOLLIN | EPOLLEXCLUSIVE, {.ptr = NULL}};
+    struct epoll_event stopEvent = {EPOLLIN, {.ptr = server}};
+    if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, server->listenFd, &listenEvent) != 0
+        || epoll_ctl(epollFd, EPOLL_CTL_ADD, server->stopFd, &stopEvent) != 0) {
+        printf("Error: could not set up epoll: %s\n", strerror(errno));
+        if (epollFd >= 0) {
+            close(epollFd);
+        }
+        return NULL;
+    }
+
+    struct epoll_event events[SERVER_EVENTS];
+    int stopping = 0;
+    while (!stopping) {
+        int ready = epoll_wait(epollFd, events, SERVER_EVENTS, -1);
+        if (ready < 0 && errno != EINTR) {
+            printf("Error: epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < ready; i++) {
+            struct Session *session = events[i].data.ptr;
+            if (events[i].data.ptr == server) {
+                stopping = 1;
+            } else if (session == NULL) {
+                int fd;
+                while ((fd = accept4(server->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    openSession(server, epollFd, fd);
+                }
+            } else if (!serveSession(session)) {
+                closeSession(server, session);
+            }
+        }
+    }
+    while (server->firstSession != NULL) {
+        closeSession(server, server->firstSession);
+    }
+    close(epollFd);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "/tmp/rogue.sock";
+    int threadCount = argc > 2 ? atoi(argv[2]) : 1;
+    long seedCount = argc > 3 ? atol(argv[3]) : 0;
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (threadCount < 1 || seedCount < 0 || strlen(path) >= sizeof(address.sun_path)) {
+        printf("Usage: %s [socket path] [threads] [seeds]\n", argv[0]);
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+
+    signal(SIGPIPE, SIG_IGN); // a client hanging up mid-frame is a failed write, not a crash
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(path); // left behind by an earlier run
+    if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(listenFd, SOMAXCONN) != 0) {
+        printf("Error: could not listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // SIGINT and SIGTERM are blocked in every thread and taken by sigwait below,
+    // which then writes to the stop pipe every thread's epoll set watches
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+    int stopFds[2];
+    uint64_t serverSeed = time(NULL);
+    struct ServerThread *threads = calloc(threadCount, sizeof(struct ServerThread));
+    if (threads == NULL || pipe2(stopFds, O_CLOEXEC) != 0) {
+        printf("Error: could not allocate the server threads\n");
+        free(threads);
+        close(listenFd);
+        unlink(path);
+        return 1;
+    }
+    printf("Serving on %s with %d threads, seed %" PRIu64 "\n", path, threadCount, serverSeed);
+    fflush(stdout);
+    int started = 0;
+    for (; started < threadCount; started++) {
+        struct ServerThread *server = &threads[started];
+        server->listenFd = listenFd;
+        server->stopFd = stopFds[0];
+        server->serverSeed = serverSeed;
+        server->seedCount = seedCount;
+        if (!initGenerator(&server->gen, 3, 3) || !initLevelCache(&server->cache, SERVER_CACHED_LEVELS)
+            || pthread_create(&server->thread, NULL, serverLoop, server) != 0) {
+            printf("Error: could not start server thread %d\n", started);
+            freeLevelCache(&server->cache);
+            freeGenerator(&server->gen);
+            break;
+        }
+    }
+    int status = 1;
+    if (started == threadCount) {
+        int signalNumber;
+        sigwait(&stopSignals, &signalNumber);
+        printf("Stopping on signal %d\n", signalNumber);
+        status = 0;
+    }
+    // the byte is never read, so the pipe stays readable for every thread
+    if (write(stopFds[1], "", 1) != 1) {
+        printf("Error: could not stop the server threads: %s\n", strerror(errno));
+        return 1;
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t].thread, NULL);
+        freeLevelCache(&threads[t].cache);
+        freeGenerator(&threads[t].gen);
+    }
+    free(threads);
+    close(stopFds[0]);
+    close(stopFds[1]);
+    close(listenFd);
+    unlink(path);
+    return status;
+}
+#else
+// Usage: ./maptest3 [level pack [seed]] plays a level from a pack instead of a new one
+int main(int argc, char *argv[])
+{
+    // At the start of the level setup
+    long long start = monotonicNanos(); // time profiling 1
+    
+    printf("Welcome to Rogue Study!\n");
+
+    // change back when in prod 
+    uint64_t randomSeed = time(NULL);
+    // printf("Fixed seed: %d\n", fixedSeed);
+    printf("Random seed: %" PRIu64 "\n", randomSeed);
+    char keys[64]; // keys read in one turn: 'wasd' to move or 'q' to quit
+    // initialize display message that gives player info regarding out of bounds, etc.
+    char message[80];
+    strcpy(message, "");
+
+    struct Generator gen;
+    struct GameState game;
+    if (!initGenerator(&gen, 3, 3)) {
+        return 1;
+    }
+    int loaded = 0; // 1 once the level came from a pack
+#ifndef _WIN32
+    struct LevelPack pack = {0};
+    if (argc > 1) {
+        if (!openLevelPack(&pack, argv[1])) {
+            return 1;
+        }
+        // the level for the given seed, or one picked at random
+        int index = argc > 2 ? findPackedLevel(&pack, strtoull(argv[2], NULL, 10))
+                             : pack.levelCount > 0 ? (int)(randomSeed % pack.levelCount) : -1;
+        if (index < 0) {
+            printf("Error: %s holds no level with seed %s\n", argv[1], argc > 2 ? argv[2] : "(empty pack)");
+            return 1;
+        }
+        randomSeed = pack.index[index].seed;
+        printf("Packed seed: %" PRIu64 "\n", randomSeed);
+        if (!initPackedGame(&game, &pack, index)) {
+            return 1;
+        }
+        loaded = 1;
+    }
+#endif
+    // the sensor reads the distance fields, which packed levels already carry
+    if (!loaded && (!initGame(&game, &gen, randomSeed) || !buildDistanceFields(&gen, &game.level))) {
+        printf("Error: could not allocate the level\n");
+        return 1;
+    }
+    struct TileMap *map = &game.level.tiles; // the board
+    struct Renderer renderer;
+    if (!initRenderer(&renderer, 1, map->rows, map->cols)) { // stdout
+        printf("Error: could not allocate the renderer\n");
+        return 1;
+    }
+
+    // mark top left room as "visible" by filling it with stars
+    // uncomment this line when not debugging
+    // fillRectWithStars(map, &game.level.rooms, game.level.startRoomIndex, TILE_FOG);
 
     // At the end of the level setup
-    clock_t end = clock(); // time profiling 2
+    long long end = monotonicNanos(); // time profiling 2
 
     // Calculate the time taken by the level setup
-    double time_taken = ((double)end - start) / CLOCKS_PER_SEC;
+    double time_taken = (end - start) / 1e9;
     printf("Setup time: %f seconds\n", time_taken);
+    // the first frame clears the screen, so keep the seed and setup time on it
+    snprintf(message, sizeof(message), "Seed %" PRIu64 ", setup took %f seconds", randomSeed, time_taken);
+
+    // keys take effect as soon as they are pressed, no Enter needed
+    int raw = enableRawInput();
+    const char *prompt = raw ? "Press a direction to move (wasd) or q to quit: "
+                             : "Enter a direction to move (wasd) or q to quit: ";
+    long long keyArrival = 0; // when the keys of the last turn arrived, 0 before the first
+    long long latencyTotal = 0, latencyMax = 0; // from a key arriving to its frame being sent
+    long latencyCount = 0;
 
     // main game loop
-    while (1)
+    while (!game.finished)
     {
-        // clear the console
-        // system("clear"); // TODO: uncomment this line when not debugging
-        // print message
-        printf("%s\n", message);
-        // print the board w/ player on it
-        printMatrix(matrix, ROWS, COLS);
-        // take in user input WASD to move player 1
-        printf("Enter a direction to move (wasd) or q to quit: ");
-        scanf(" %c", &input); // TIL: space before %c to skip whitespace, including newline
-        if (input == 'q')
-        {
-            printf("Quitting...\n");
-            printNotQuit = 0;
-            break;
+        // print the message, the board w/ player on it and the prompt, only
+        // sending what changed since the last turn
+        renderFrame(&renderer, &game.level, game.playerLocation, message, prompt);
+        if (keyArrival) {
+            long long latency = monotonicNanos() - keyArrival;
+            latencyTotal += latency;
+            latencyMax = latency > latencyMax ? latency : latencyMax;
+            latencyCount++;
         }
-        else // not quitting
-        {
-            if (pointIsDoorFloorOrCorridor(matrix, destinationPoint(playerLocation, input))) {            
-                // Before updating the player's position, restore the previous cell
-                matrix[playerLocation.y][playerLocation.x] = playerCell;
-                // clear the message
-                strcpy(message, "");
-                // Update the player's position
-                playerLocation = destinationPoint(playerLocation, input);
-                // Store the original character of the new cell and place the player
-                playerCell = matrix[playerLocation.y][playerLocation.x];
-                matrix[playerLocation.y][playerLocation.x] = PLAYER_CHAR;
-            } else if (matrix[destinationPoint(playerLocation, input).y][destinationPoint(playerLocation, input).x] == EXIT_CHAR) {
-                strcpy(message, "You win!");
-                matrix[playerLocation.y][playerLocation.x] = playerCell; // restore prev cell tile
-                playerLocation = destinationPoint(playerLocation, input); // update player location
-                matrix[playerLocation.y][playerLocation.x] = PLAYER_CHAR; // place player
-                break;
-            } else if (matrix[destinationPoint(playerLocation, input).y][destinationPoint(playerLocation, input).x] == TREASURE_CHAR) {
-                strcpy(message, "You found the treasure!");
-                // update treasure location to -1, -1
-                // update swap tile ("player cell") under player to be a floor tile
-                // update player location to be the treasure location
-                treasureLocation = (struct Point) {-1, -1};
-                matrix[playerLocation.y][playerLocation.x] = playerCell; // restore prev cell tile
-                playerLocation = destinationPoint(playerLocation, input); // update player location
-                playerCell = '.'; // store blank cell tile to update after player moves away from where the treasure was
-                matrix[playerLocation.y][playerLocation.x] = PLAYER_CHAR; // place player
-            } else {
-                if(!pointIsDoorFloorOrCorridor(matrix, destinationPoint(playerLocation, input))) {
-                    strcpy(message, "Invalid move");
-                } else {
-                    strcpy(message, "Unknown error, code 001");
-                }
+
+        // take in user input WASD to move player 1, every key queued since the
+        // last frame is applied before the next one is drawn
+        int keyCount = readKeys(keys, sizeof(keys), &keyArrival);
+        if (keyCount == 0) {
+            keys[keyCount++] = 'q'; // end of input
+        }
+        int treasureDistance = distanceToTreasure(&game.level, game.playerLocation);
+        for (int i = 0; i < keyCount && !game.finished; i++) {
+            enum StepResult result = step(&game, actionFromKey(keys[i]));
+            if (result == STEP_QUIT) {
+                printNotQuit = 0;
             }
+            strcpy(message, stepMessages[result]);
+        }
+        // the magic sensor: a walking distance lookup, not a search
+        int newDistance = distanceToTreasure(&game.level, game.playerLocation);
+        if (message[0] == '\0' && !game.hasTreasure && newDistance != treasureDistance) {
+            strcpy(message, newDistance < treasureDistance ? "The sensor grows warmer" : "The sensor grows colder");
         }
     }
 
     // finally, print the last message and board state before ending the game
-    // clear the console
-    // system("clear"); // TODO: uncomment this line when not debugging
-    // print message
     if(printNotQuit) {
-        printf("%s\n", message);
-        // print the board w/ player on it
-        printMatrix(matrix, ROWS, COLS);
+        renderFrame(&renderer, &game.level, game.playerLocation, message, "");
+    } else {
+        printf("\nQuitting...\n");
     }
+    restoreTerminal();
 
     printf("Thanks for playing!\n");
-    free(rooms);
-    free(corridors);
-    free(connectionsCount);
-    free(firstWallPoint);
-    free(secondWallPoint);
+    if (game.finished && printNotQuit) {
+        printf("You took %ld steps, the shortest way from the start to the exit is %d\n",
+               game.moves, distanceToExit(&game.level, game.level.playerLocation));
+    }
+    if (latencyCount > 0) {
+        printf("Input latency over %ld turns: mean %.1f us, max %.1f us (key arrival to frame sent)\n",
+               latencyCount, latencyTotal / 1e3 / latencyCount, latencyMax / 1e3);
+    }
+    freeRenderer(&renderer);
+    freeGame(&game);
+    freeGenerator(&gen);
+#ifndef _WIN32
+    closeLevelPack(&pack);
+#endif
 
     return 0;
 }
+#endif